@@ -15,13 +15,76 @@ extern "C" {
 
 
 	
-	#define SIM868_BAUDRATE			9600
+	#define SIM868_BAUDRATE			9600	//first rate tried, module autobauds from it
+	#define SIM868_BAUDRATE_MAX		115200	//raised with AT+IPR up to this rate
+	#define SIM868_BAUDRATE_ERROR	20		//max UBRR rate error, per mille
 	
 	#define SIM868_EN_PIN			B,5
+	#define SIM868_POWER_PULSE_TICK		( 1000 / SIM868_TIMEOUT_TICK )	//PWRKEY low time
+	#define SIM868_POWER_PROBE_TICK		( 1500 / SIM868_TIMEOUT_TICK )	//module may be on already, checked before the pulse
+	#define SIM868_POWER_POKE_TICK		( 250 / SIM868_TIMEOUT_TICK )	//"AT" period until the module answers
+	#define SIM868_POWER_ATTEMPTS		2
+	
+	#define SIM868_SLEEP_MODE			1		//AT+CSCLK between transactions: 1 DTR controlled, 2 automatic on UART idle, 0 never
+	#define SIM868_DTR_PIN				B,4		//used in mode 1
+	#define SIM868_SLEEP_IDLE_TICK		( 5000 / SIM868_TIMEOUT_TICK )	//no commands, requests, socket or MUX for this long
+	#define SIM868_SLEEP_WAKE_TICK		( 100 / SIM868_TIMEOUT_TICK )	//DTR low or dummy byte to the first command, 50 ms min
 	
 	#define SIM868_BUFFER_SIZE		255
 	#define SIM868_DELAY_TICK_MS	400
-	#define SIM868_TIMEOUT_TICK		4
+	#define SIM868_TIMEOUT_TICK		4		//sim868_update() call period, ms
+	
+	#define SIM868_COMMAND_QUEUE_SIZE	8
+	#define SIM868_COMMAND_GUARD_TICK	25		//pause before each command, ticks
+	
+	#define SIM868_RX_RING_SIZE			256		//power of two, up to 256
+	#define SIM868_RX_LINE_RING_SIZE	32		//power of two, up to 256
+	#define SIM868_LINE_SIZE			64
+	#define SIM868_TX_RING_SIZE			64		//power of two, up to 256
+	#define SIM868_TX_SEGMENT_SIZE		8		//power of two, PROGMEM strings and runs of ring bytes queued
+	#define SIM868_RESPONCE_PATTERN_SIZE	32		//longest expected responce, up to 255
+	
+	#define SIM868_REQUEST_QUEUE_SIZE	4
+	#define SIM868_REQUEST_SEND_TICK	( 120000UL / SIM868_TIMEOUT_TICK )	//blocking sends give up on a request not started by then
+	#define SIM868_BATCH_SIZE			4		//commands joined on one AT line
+	#define SIM868_HTTPREAD_WINDOW		128		//HTTPREAD size for a sink callback, up to SIM868_BUFFER_SIZE
+	#define SIM868_APN					"internet"
+	#define SIM868_SOCKET_ESCAPE_TICK	( 1000 / SIM868_TIMEOUT_TICK )	//guard time around "+++"
+	
+	#define SIM868_SESSION_IDLE_TICK	( 30000 / SIM868_TIMEOUT_TICK )	//keep bearer and HTTP open, 0 to close after each request
+	
+	#define SIM868_SIGNAL_RSSI_MIN		10		//+CSQ rssi, -93 dBm, deferred requests wait for it
+	#define SIM868_SIGNAL_BER_MAX		4		//+CSQ ber (RXQUAL), 99 is not known and taken as good
+	#define SIM868_SIGNAL_SAMPLE_TICK	( 20000 / SIM868_TIMEOUT_TICK )	//AT+CSQ period while requests are deferred
+	#define SIM868_REQUEST_CURRENT_MA	300		//module average during a request, for the charge estimate
+	
+	//Retry policies: attempts with the first one, first backoff and its cap, deadline from the first attempt or 0; ticks
+	#define SIM868_RETRY_POLICY_REG		{ 5, 1000 / SIM868_TIMEOUT_TICK, 8000 / SIM868_TIMEOUT_TICK, 30000UL / SIM868_TIMEOUT_TICK }
+	#define SIM868_RETRY_POLICY_BEARER	{ 3, 500 / SIM868_TIMEOUT_TICK, 4000 / SIM868_TIMEOUT_TICK, 20000UL / SIM868_TIMEOUT_TICK }
+	#define SIM868_RETRY_POLICY_HTTP	{ 2, 1000 / SIM868_TIMEOUT_TICK, 4000 / SIM868_TIMEOUT_TICK, 60000UL / SIM868_TIMEOUT_TICK }
+	#define SIM868_RETRY_POLICY_GNSS	{ 3, 250 / SIM868_TIMEOUT_TICK, 1000 / SIM868_TIMEOUT_TICK, 5000UL / SIM868_TIMEOUT_TICK }
+	
+	#define SIM868_FIX_CACHE_SIZE			4
+	#define SIM868_FIX_PREDICT_TICK			( 30000 / SIM868_TIMEOUT_TICK )	//older fixes are served without moving them
+	#define SIM868_FIX_PREDICT_SPEED_MIN	200		//km/h * 100, slower fixes are not moved
+	
+	#define SIM868_MUX_FRAME_SIZE			31		//N1, information bytes per frame, up to 127
+	#define SIM868_MUX_RING_SIZE			64		//power of two, up to 256, for each of the NMEA and data channels
+	#define SIM868_MUX_OPEN_TICK			( 1000 / SIM868_TIMEOUT_TICK )	//wait for UA to SABM, and for OK to CGNSTST on the NMEA channel
+	#define SIM868_MUX_TX_FRAMES			4		//frames held while the module stops a channel, then bytes are refused
+	
+	#define SIM868_TRACK_SIZE				128		//encoded points, kept in an EEPROM ring too
+	#define SIM868_TRACK_STATE_SLOTS		4		//EEPROM copies of the track state, written in turn
+	#define SIM868_TRACK_SAVE_POINTS		8		//ring bytes and state are written to EEPROM every this many points, the rest are lost on a reset
+	#define SIM868_TRACK_UPLOAD_SIZE		96		//upload when this many bytes are recorded
+	#define SIM868_TRACK_UPLOAD_TICK		( 300000 / SIM868_TIMEOUT_TICK )	//or when the oldest point is this old
+	#define SIM868_TRACK_UPLOAD_DEADLINE	( 600000UL / SIM868_TIMEOUT_TICK )	//upload waits this long for good signal
+	
+	#define SIM868_OUTBOX_SLOTS				16		//EEPROM records, SIM868_OUTBOX_RECORD_SIZE + 6 bytes each
+	#define SIM868_OUTBOX_RECORD_SIZE		26		//up to 255
+	#define SIM868_OUTBOX_BATCH				8		//records in one POST body
+	#define SIM868_OUTBOX_RETRY_TICK		( 60000 / SIM868_TIMEOUT_TICK )	//after a failed upload
+	#define SIM868_OUTBOX_DEADLINE			( 600000UL / SIM868_TIMEOUT_TICK )	//upload waits this long for good signal
 	
 
 
@@ -6,11 +6,16 @@
  */ 
 
 #include "../config/ide_config.h"
+#include <stddef.h>
+#include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
 #include <util/delay.h>
 
 #include "sim868.h"
 #include "sim868_data.h"
+#include "sim868_fix.h"
 #include "../config/sim868_config.h"
 #include "../drivers/interrupts.h"
 #include "../drivers/gpio.h"
@@ -20,6 +25,7 @@
 
 
 
+char sim868_buffer[ SIM868_BUFFER_SIZE ];
 unsigned int  sim868_buffer_pointer;
 unsigned char sim868_buffer_flag;
 unsigned int  sim868_buffer_write_len;
@@ -29,59 +35,672 @@ unsigned int sim868_responce_buf_len;
 unsigned int sim868_responce_buf_len_max = SIM868_BUFFER_SIZE;
 const char* sim868_responce;
 unsigned char sim868_responce_flag;
-unsigned int  sim868_responce_pointer;
 unsigned int  sim868_responce_write_pointer_begin;
 unsigned int  sim868_responce_write_pointer_end;
-unsigned int  sim868_responce_len;
+unsigned char sim868_responce_len;
 unsigned int  sim868_responce_line;
 unsigned char sim868_responce_write_flag;
 
 char sim868_readed_char;
 unsigned char sim868_buffer_stop_char;
 
+sim868_command_t sim868_command_queue[ SIM868_COMMAND_QUEUE_SIZE ];
+unsigned char sim868_command_queue_head;
+unsigned char sim868_command_queue_tail;
+unsigned char sim868_command_queue_count;
+unsigned char sim868_command_state;
+unsigned int  sim868_command_tick;
+unsigned int  sim868_command_line_count;
+unsigned int  sim868_command_length;
+unsigned int  sim868_command_data_len;
+unsigned char sim868_command_wait_flag;
+unsigned char sim868_command_wait_code;
 
+//Independent commands joined as "AT+A;+B;+C", sent again one at a time if the line fails
+sim868_command_t sim868_batch[ SIM868_BATCH_SIZE ];
+unsigned char sim868_batch_count;		//0 when no batch runs
+unsigned char sim868_batch_index;		//next command sent alone
+unsigned char sim868_batch_code;
+sim868_callback_t sim868_batch_callback;
+sim868_batch_stat_t sim868_batch_stat;
 
-void sim868_power_en(void);
+const char* sim868_http_host;
+const char* sim868_http_path;
+const char* sim868_http_params;
+const char* sim868_http_content;
+
+//Bearer and HTTP service stay open between requests, closed after SIM868_SESSION_IDLE_TICK or on error
+#define SIM868_SESSION_BEARER			0x01
+#define SIM868_SESSION_HTTP				0x02
+#define SIM868_SESSION_HTTP_CID			0x04
+#define SIM868_SESSION_HTTP_URL			0x08
+#define SIM868_SESSION_HTTP_CONTENT		0x10
+#define SIM868_SESSION_HTTP_ALL			( SIM868_SESSION_HTTP | SIM868_SESSION_HTTP_CID | SIM868_SESSION_HTTP_URL | SIM868_SESSION_HTTP_CONTENT )
+
+unsigned char sim868_session_state;
+unsigned int  sim868_session_idle_tick;
+unsigned int  sim868_session_url_crc;
+const char*   sim868_session_content;		//PROGMEM content type set while SIM868_SESSION_HTTP_CONTENT
+
+//Requests queued by sim868_request_put(), run as a chain of command callbacks
+#define SIM868_REQUEST_STATE_IDLE			0
+#define SIM868_REQUEST_STATE_CREG			1
+#define SIM868_REQUEST_STATE_BEARER_TYPE	2
+#define SIM868_REQUEST_STATE_BEARER_OPEN	3
+#define SIM868_REQUEST_STATE_HTTP_INIT		4
+#define SIM868_REQUEST_STATE_HTTP_CID		5
+#define SIM868_REQUEST_STATE_HTTP_URL		6
+#define SIM868_REQUEST_STATE_HTTP_CONTENT	7
+#define SIM868_REQUEST_STATE_HTTP_DATA		8
+#define SIM868_REQUEST_STATE_HTTP_BODY		9
+#define SIM868_REQUEST_STATE_HTTP_ACTION	10
+#define SIM868_REQUEST_STATE_HTTP_READ		11
+#define SIM868_REQUEST_STATE_HTTP_READ_DATA	12
+
+sim868_request_t sim868_request_queue[ SIM868_REQUEST_QUEUE_SIZE ];
+unsigned char sim868_request_queue_count;
+sim868_request_t sim868_request;
+unsigned char sim868_request_state;
+unsigned char sim868_request_retry;
+unsigned char sim868_request_group;
+unsigned int  sim868_request_host_crc;
+unsigned int  sim868_request_url_crc;
+unsigned int  sim868_request_read_total;		//body length from HTTPACTION
+unsigned int  sim868_request_status;			//HTTP status other than 200 the server answered with, 0 if none
+unsigned int  sim868_request_read_offset;		//bytes delivered to the sink
+unsigned int  sim868_request_read_len;			//current HTTPREAD window
+unsigned long sim868_request_tick;
+unsigned char sim868_request_wait_flag;
+unsigned char sim868_request_wait_code;
+unsigned int  sim868_request_wait_len;
+unsigned char sim868_request_para;				//SIM868_SESSION_HTTP_* set by a joined HTTPPARA line
+
+unsigned long sim868_tick;
+unsigned long sim868_tx_bytes;
+unsigned long sim868_baudrate;
+
+//Power up sequence, advanced by readiness URCs from sim868_unsolicited_update()
+unsigned char sim868_power_state;
+unsigned long sim868_power_tick;			//state entered at
+unsigned long sim868_power_start_tick;
+unsigned long sim868_power_poke_tick;
+unsigned char sim868_power_rate;
+sim868_power_stat_t sim868_power_stat;
+
+//Recovery ladder, see SIM868_RECOVER_*
+sim868_recover_stat_t sim868_recover_stat;
+unsigned long sim868_recover_tick;			//first failure
+unsigned char sim868_recover_wait;			//module restarts, requests wait for SIM868_POWER_READY
+
+//Driver and session state kept over a watchdog reset, taken back by sim868_init() when the checksum is good
+typedef struct
+{
+	unsigned long baudrate;
+	unsigned long recover_ticks;	//spent in the ladder before the reset
+	sim868_recover_stat_t recover;
+	unsigned int  session_url_crc;
+	const char*   session_content;	//flash address, the same firmware runs after a watchdog reset
+	unsigned char session_state;
+	unsigned char power_state;
+	unsigned int  magic;
+	unsigned int  crc;
+} sim868_warm_t;
+
+#define SIM868_WARM_MAGIC				0x574D
+
+sim868_warm_t sim868_warm __attribute__ (( section(".noinit") ));
+unsigned char sim868_reset_cause __attribute__ (( section(".noinit") ));	//MCUSR, set in .init3 before .bss is cleared
+unsigned char sim868_warm_session;			//session state to take back if the module stayed on
+
+//Retry policies by SIM868_RETRY_*, attempts of the current operation of each class
+typedef struct
+{
+	unsigned long begin;			//tick of the first attempt
+	unsigned char attempt;			//0 when no operation runs
+} sim868_retry_t;
+
+sim868_retry_policy_t sim868_retry_policy[ SIM868_RETRY_CLASSES ] = { SIM868_RETRY_POLICY_REG, SIM868_RETRY_POLICY_BEARER, SIM868_RETRY_POLICY_HTTP, SIM868_RETRY_POLICY_GNSS };
+sim868_retry_t sim868_retry[ SIM868_RETRY_CLASSES ];
+sim868_retry_stat_t sim868_retry_stat[ SIM868_RETRY_CLASSES ];
+unsigned int  sim868_retry_seed;
+
+//AT+CSCLK sleep, entered after SIM868_SLEEP_IDLE_TICK without work, left by the next command
+unsigned char sim868_sleep_state;
+unsigned char sim868_sleep_latency_wait;	//first responce byte after a wake is not in yet
+unsigned long sim868_sleep_tick;			//last work, sleep or wake
+unsigned long sim868_sleep_wake_tick;
+sim868_sleep_stat_t sim868_sleep_stat;
+
+//Registration cache, fed by +CREG lines after AT+CREG=2 so requests do not poll the network
+sim868_reg_t sim868_reg = { .status = SIM868_REG_NONE };
+
+//Signal cache, sampled with AT+CSQ only while requests wait for it
+sim868_signal_t sim868_signal = { .rssi = SIM868_SIGNAL_UNKNOWN, .ber = SIM868_SIGNAL_UNKNOWN };
+sim868_signal_stat_t sim868_signal_stat;
+unsigned char sim868_signal_sampling;
+unsigned long sim868_request_tx_bytes;
+sim868_request_stat_t sim868_request_stat;
+
+//Single CIPSTART connection, one operation at a time
+#define SIM868_SOCKET_OP_NONE			0
+#define SIM868_SOCKET_OP_OPEN			1
+#define SIM868_SOCKET_OP_SEND			2
+#define SIM868_SOCKET_OP_RECEIVE		3
+#define SIM868_SOCKET_OP_CLOSE			4
+
+unsigned char sim868_socket_state;
+unsigned char sim868_socket_op;
+unsigned char sim868_socket_op_step;
+unsigned char sim868_socket_type;
+unsigned char sim868_socket_transparent;
+unsigned char sim868_socket_rx_flag;
+const char*   sim868_socket_host;
+unsigned int  sim868_socket_port;
+char*         sim868_socket_data;
+unsigned int  sim868_socket_len;
+unsigned int  sim868_socket_result;
+unsigned long sim868_socket_tick;
+unsigned long sim868_socket_tx_bytes;
+sim868_socket_callback_t sim868_socket_callback;
+sim868_socket_stat_t sim868_socket_stat;
+
+#define SIM868_COMMAND_STATE_IDLE		0
+#define SIM868_COMMAND_STATE_GUARD		1
+#define SIM868_COMMAND_STATE_WAIT		2
+
+#define SIM868_RX_RING_MASK				( SIM868_RX_RING_SIZE - 1 )
+#define SIM868_RX_LINE_RING_MASK		( SIM868_RX_LINE_RING_SIZE - 1 )
+
+#if ( SIM868_RX_RING_SIZE & SIM868_RX_RING_MASK ) || ( SIM868_RX_RING_SIZE > 256 )
+	#error "SIM868_RX_RING_SIZE must be a power of two up to 256"
+#endif
+#if ( SIM868_RX_LINE_RING_SIZE & SIM868_RX_LINE_RING_MASK ) || ( SIM868_RX_LINE_RING_SIZE > 256 )
+	#error "SIM868_RX_LINE_RING_SIZE must be a power of two up to 256"
+#endif
+
+//Single producer (usart ISR) / single consumer (sim868_update) ring, 8 bit indexes are atomic
+char sim868_rx_ring[ SIM868_RX_RING_SIZE ];
+volatile unsigned char sim868_rx_head;
+volatile unsigned char sim868_rx_tail;
+unsigned char sim868_rx_line_ring[ SIM868_RX_LINE_RING_SIZE ];	//positions of '\n' in sim868_rx_ring
+volatile unsigned char sim868_rx_line_head;
+volatile unsigned char sim868_rx_line_tail;
+volatile unsigned int  sim868_rx_overflow;
+unsigned int  sim868_tx_overflow;			//bytes dropped on a full queue with global interrupts off
+volatile unsigned char sim868_rx_binary;	//raw data is on the way, '$' at a line start is not NMEA
+
+#define SIM868_TX_RING_MASK				( SIM868_TX_RING_SIZE - 1 )
+#define SIM868_TX_SEGMENT_MASK			( SIM868_TX_SEGMENT_SIZE - 1 )
+
+#if ( SIM868_TX_RING_SIZE & SIM868_TX_RING_MASK ) || ( SIM868_TX_RING_SIZE > 256 )
+	#error "SIM868_TX_RING_SIZE must be a power of two up to 256"
+#endif
+#if ( SIM868_TX_SEGMENT_SIZE & SIM868_TX_SEGMENT_MASK ) || ( SIM868_TX_SEGMENT_SIZE > 256 )
+	#error "SIM868_TX_SEGMENT_SIZE must be a power of two up to 256"
+#endif
+
+//Transmitter queue, drained by the usart data register empty ISR: segments are sent in order,
+//a segment is a PROGMEM string sent in place or, with data 0, a run of bytes from sim868_tx_ring.
+//Without the empty interrupt in drivers/usart.h bytes are sent one by one and waited for
+#ifdef usart_empty_intr_en
+	#define SIM868_TX_QUEUE
+#endif
+
+typedef struct
+{
+	const char*   data;
+	unsigned int  len;
+} sim868_tx_segment_t;
+
+#ifdef SIM868_TX_QUEUE
+char sim868_tx_ring[ SIM868_TX_RING_SIZE ];
+unsigned char sim868_tx_head;
+volatile unsigned char sim868_tx_tail;
+volatile sim868_tx_segment_t sim868_tx_segment[ SIM868_TX_SEGMENT_SIZE ];
+volatile unsigned char sim868_tx_segment_head;
+volatile unsigned char sim868_tx_segment_tail;
+#endif
+
+char sim868_unsolicited_buf[ SIM868_LINE_SIZE ];
+unsigned char sim868_unsolicited_len;
+
+//GSM 07.10 basic option multiplexer: the ISR takes frames apart and routes the information
+//by DLCI, the AT channel to sim868_rx_ring as without the multiplexer
+#define SIM868_MUX_FLAG					0xF9
+#define SIM868_MUX_EA					0x01
+#define SIM868_MUX_CR					0x02
+#define SIM868_MUX_PF					0x10
+#define SIM868_MUX_SABM					0x2F
+#define SIM868_MUX_UA					0x63
+#define SIM868_MUX_DM					0x0F
+#define SIM868_MUX_DISC					0x43
+#define SIM868_MUX_UIH					0xEF
+#define SIM868_MUX_UI					0x03
+#define SIM868_MUX_FCS_GOOD				0xCF
+
+//Control channel messages, type octet with EA and C/R
+#define SIM868_MUX_MSC_COMMAND			0xE3
+#define SIM868_MUX_MSC_RESPONCE			0xE1
+#define SIM868_MUX_FCON_COMMAND			0xA3
+#define SIM868_MUX_FCON_RESPONCE		0xA1
+#define SIM868_MUX_FCOFF_COMMAND		0x63
+#define SIM868_MUX_FCOFF_RESPONCE		0x61
+#define SIM868_MUX_CLD_COMMAND			0xC3
+#define SIM868_MUX_V24					0x8D	//DV, RTR, RTC, EA
+#define SIM868_MUX_V24_FC				0x02	//flow control, sender must stop
+
+#define SIM868_MUX_RX_FLAG				0
+#define SIM868_MUX_RX_ADDRESS			1
+#define SIM868_MUX_RX_CONTROL			2
+#define SIM868_MUX_RX_LENGTH			3
+#define SIM868_MUX_RX_DATA				4
+#define SIM868_MUX_RX_FCS				5
+#define SIM868_MUX_RX_END				6
+
+#define SIM868_MUX_REPLY_MSC			0x01
+#define SIM868_MUX_REPLY_FCON			0x02
+#define SIM868_MUX_REPLY_FCOFF			0x04
+
+#define SIM868_MUX_FLOW_ALL				0x80	//FCoff, bits 0..3 are MSC FC of each DLCI
+
+#define SIM868_MUX_RING_MASK			( SIM868_MUX_RING_SIZE - 1 )
+
+#if ( SIM868_MUX_RING_SIZE & SIM868_MUX_RING_MASK ) || ( SIM868_MUX_RING_SIZE > 256 )
+	#error "SIM868_MUX_RING_SIZE must be a power of two up to 256"
+#endif
+#if SIM868_MUX_FRAME_SIZE > 127
+	#error "SIM868_MUX_FRAME_SIZE must fit the one octet length"
+#endif
+
+volatile unsigned char sim868_mux_state;
+volatile unsigned char sim868_mux_flow;
+volatile unsigned char sim868_mux_reply;
+volatile unsigned char sim868_mux_ack;			//UA or DM to the last SABM
+unsigned char sim868_mux_ack_dlci;
+unsigned char sim868_mux_msc_address;			//last MSC command, echoed in the responce
+unsigned char sim868_mux_msc_signals;
+
+unsigned char sim868_mux_rx_state;
+unsigned char sim868_mux_rx_address;
+unsigned char sim868_mux_rx_control;
+unsigned char sim868_mux_rx_len;
+unsigned char sim868_mux_rx_index;
+unsigned char sim868_mux_rx_fcs;
+unsigned char sim868_mux_rx_buf[ SIM868_MUX_FRAME_SIZE ];
+
+//Frames waiting for flow control in order, the one after them is being filled
+char sim868_mux_tx_buf[ SIM868_MUX_TX_FRAMES ][ SIM868_MUX_FRAME_SIZE ];
+unsigned char sim868_mux_tx_len[ SIM868_MUX_TX_FRAMES ];
+unsigned char sim868_mux_tx_channel[ SIM868_MUX_TX_FRAMES ];
+unsigned char sim868_mux_tx_first;
+unsigned char sim868_mux_tx_held;
+
+char sim868_mux_ring[2][ SIM868_MUX_RING_SIZE ];	//SIM868_MUX_NMEA and SIM868_MUX_DATA
+volatile unsigned char sim868_mux_ring_head[2];
+volatile unsigned char sim868_mux_ring_tail[2];
+
+sim868_mux_stat_t sim868_mux_stat[ SIM868_MUX_CHANNELS ];
+
+//Incremental matcher, fed with every responce byte: KMP automaton for the expected responce
+//and line start tokens (OK, ERROR, +CME ERROR, URC prefixes) from sim868_token_table
+unsigned char sim868_match_fail[ SIM868_RESPONCE_PATTERN_SIZE ];
+unsigned char sim868_match_state;
+unsigned char sim868_match_flags;
+unsigned char sim868_match_result;
+unsigned char sim868_match_column;
+unsigned char sim868_match_token;
+unsigned int  sim868_match_line_begin;		//in sim868_responce_buf
+unsigned long sim868_match_token_alive;
+
+#define SIM868_MATCH_FLAG_ENABLED		0x01
+#define SIM868_MATCH_FLAG_FOUND			0x02	//expected responce found
+#define SIM868_MATCH_FLAG_FOUND_LINE	0x04	//expected responce found in the current line
+#define SIM868_MATCH_FLAG_OK			0x08	//OK received
+#define SIM868_MATCH_FLAG_DEFERRED		0x10
+#define SIM868_MATCH_FLAG_PROMPT		0x20
+
+#define SIM868_MATCH_NONE				0xFF
+
+//NMEA pushed by AT+CGNSTST=1, "$...*hh" lines are parsed in the usart ISR and never reach sim868_rx_ring
+typedef struct
+{
+	long          time;			//hhmmss * 1000 + milliseconds
+	long          date;			//ddmmyy
+	long          latitude;		//ddmm.mmmmm * 100000, south negative
+	long          longitude;	//dddmm.mmmmm * 100000, west negative
+	long          altitude;		//meters * 100
+	unsigned long fields;		//1 << SIM868_FIX_FIELD_*
+	unsigned int  speed;		//knots * 100
+	unsigned int  course;		//degrees * 10
+	unsigned int  hdop;			//* 10
+	unsigned int  sentences;
+	unsigned int  errors;
+	unsigned char fix;
+	unsigned char sats;
+} sim868_nmea_raw_t;
+
+#define SIM868_NMEA_FIELD_DATE			31	//RMC only, not a +CGNSINF: field
+
+#define SIM868_NMEA_STATE_LINE_START	0x01
+#define SIM868_NMEA_STATE_SENTENCE		0x02
+#define SIM868_NMEA_STATE_CHECKSUM		0x04
+
+#define SIM868_NMEA_TYPE_RMC			( ((unsigned long)'R' << 16) | ((unsigned long)'M' << 8) | 'C' )
+#define SIM868_NMEA_TYPE_GGA			( ((unsigned long)'G' << 16) | ((unsigned long)'G' << 8) | 'A' )
+
+#define SIM868_NMEA_MERGE( member, field )	if( sim868_nmea_sentence.fields & (1UL << (field)) ) sim868_nmea_work.member = sim868_nmea_sentence.member
+
+//Seqlock snapshot: the ISR fills sim868_nmea_raw[ (seq + 1) & 1 ] and then increments seq,
+//a reader copies sim868_nmea_raw[ seq & 1 ] and retries if seq has changed meanwhile
+volatile sim868_nmea_raw_t sim868_nmea_raw[2];
+volatile unsigned char sim868_nmea_seq;
+volatile unsigned char sim868_nmea_enabled;
+
+//ISR only
+sim868_nmea_raw_t sim868_nmea_work;
+sim868_nmea_raw_t sim868_nmea_sentence;
+sim868_field_t sim868_nmea_field;
+unsigned char sim868_nmea_state = SIM868_NMEA_STATE_LINE_START;
+unsigned char sim868_nmea_index;
+unsigned char sim868_nmea_char;
+unsigned char sim868_nmea_checksum;
+unsigned char sim868_nmea_checksum_rx;
+unsigned char sim868_nmea_checksum_digits;
+unsigned long sim868_nmea_type;
+
+//Last fixes with the sim868_tick they were taken at, newest at sim868_fix_cache_head - 1
+typedef struct
+{
+	sim868_fix_t  fix;
+	unsigned long tick;
+} sim868_fix_entry_t;
+
+sim868_fix_entry_t sim868_fix_cache[ SIM868_FIX_CACHE_SIZE ];
+unsigned char sim868_fix_cache_head;
+unsigned char sim868_fix_cache_count;
+unsigned int  sim868_fix_cache_sentences;
+sim868_fix_cache_stat_t sim868_fix_cache_stat;
+
+//Track body: reference point, then points as differences from the previous one,
+//every number is a zig-zag varint: seconds from 2000-01-01 UTC, latitude and longitude * 1000000
+typedef struct
+{
+	long          time;
+	long          latitude;
+	long          longitude;
+} sim868_track_point_t;
+
+typedef struct
+{
+	sim868_track_point_t base;	//reference of the first point in sim868_track_buf, already uploaded
+	sim868_track_point_t last;	//reference of the next point
+	unsigned int  start;		//first byte in the ring
+	unsigned int  len;
+	unsigned int  count;
+	unsigned char seq;			//newest of the EEPROM slots wins
+	unsigned int  magic;
+	unsigned int  crc;			//written last, a slot torn by a reset is skipped
+} sim868_track_state_t;
+
+#define SIM868_TRACK_MAGIC				0x5453
+#define SIM868_TRACK_HEAD_SIZE			15		//3 varints up to 5 bytes
+
+unsigned char sim868_track_buf[ SIM868_TRACK_SIZE ];	//ring, uploaded bytes are not moved
+sim868_track_state_t sim868_track_state;
+sim868_track_state_t sim868_track_upload;		//state when the upload was put
+unsigned char sim868_track_head[ SIM868_TRACK_HEAD_SIZE ];
+unsigned char sim868_track_head_len;
+unsigned char sim868_track_uploading;
+unsigned long sim868_track_tick;			//oldest point not uploaded
+unsigned char sim868_track_slot;			//EEPROM state slot written last
+unsigned char sim868_track_unsaved;			//points put since the state was saved
+unsigned int  sim868_track_dirty;			//bytes at the end of the ring not written to EEPROM yet
+const char*   sim868_track_host;
+const char*   sim868_track_path;
+const char*   sim868_track_params;
+sim868_track_stat_t sim868_track_stat;
+
+unsigned char sim868_track_buf_eeprom[ SIM868_TRACK_SIZE ] EEMEM;
+sim868_track_state_t sim868_track_state_eeprom[ SIM868_TRACK_STATE_SLOTS ] EEMEM;
+
+//Outbox, EEPROM slots written round robin so each one wears the same
+#define SIM868_OUTBOX_FREE				0xFF	//erased, never written
+#define SIM868_OUTBOX_PENDING			0xA5
+#define SIM868_OUTBOX_DONE				0x00	//acknowledged, slot may be written again
+
+typedef struct
+{
+	unsigned char mark;			//SIM868_OUTBOX_*, written last
+	unsigned int  seq;			//append order, taken back by sim868_outbox_begin()
+	unsigned char len;
+	unsigned int  crc;			//of seq, len and data
+	unsigned char data[ SIM868_OUTBOX_RECORD_SIZE ];
+} sim868_outbox_slot_t;
+
+sim868_outbox_slot_t sim868_outbox_eeprom[ SIM868_OUTBOX_SLOTS ] EEMEM;
+
+unsigned char sim868_outbox_tail;			//oldest pending slot
+unsigned char sim868_outbox_head;			//next slot to write
+unsigned char sim868_outbox_count;
+unsigned int  sim868_outbox_seq;
+unsigned char sim868_outbox_uploading;
+unsigned char sim868_outbox_batch;			//slots in the upload
+unsigned char sim868_outbox_batch_len[ SIM868_OUTBOX_BATCH ];	//record lengths, 0 for a bad slot
+unsigned int  sim868_outbox_batch_bytes;
+unsigned int  sim868_outbox_cursor;			//body offset of the cursor record
+unsigned char sim868_outbox_cursor_index;
+unsigned long sim868_outbox_tick;			//failed upload, 0 if none
+const char*   sim868_outbox_host;
+const char*   sim868_outbox_path;
+const char*   sim868_outbox_params;
+sim868_outbox_stat_t sim868_outbox_stat;
+
+
+
+unsigned char sim868_power_en(void);
 void sim868_power_dis(void);
+void sim868_power_start(void);
+void sim868_power_update(void);
+void sim868_power_pulse(void);
+void sim868_power_phase( unsigned char state );
+void sim868_power_ready(void);
+void sim868_power_poke(void);
+void sim868_power_unsolicited( unsigned char id, const char* line, unsigned char len );
+void sim868_recover_update(void);
+unsigned char sim868_recover_escalate(void);
+void sim868_recover_end(void);
+void sim868_recover_cfun_done( unsigned char code );
+void sim868_recover_restart(void);
+void sim868_warm_update(void);
+void sim868_warm_save(void);
+unsigned char sim868_warm_restore(void);
+void sim868_retry_begin( unsigned char id );
+unsigned int sim868_retry_next( unsigned char id );
+void sim868_retry_done( unsigned char id );
+unsigned int sim868_retry_rand(void);
+void sim868_sleep_update(void);
+void sim868_sleep_enter_done( unsigned char code );
+void sim868_sleep_wake(void);
+unsigned char sim868_sleep_guard(void);
+void sim868_sleep_responce(void);
+void sim868_urc_dispatch( const char* line, unsigned char len );
+void sim868_urc_network( unsigned char id, const char* line, unsigned char len );
+void sim868_reg_unsolicited( unsigned char id, const char* line, unsigned char len );
+void sim868_signal_unsolicited( unsigned char id, const char* line, unsigned char len );
+unsigned char sim868_signal_good(void);
+void sim868_signal_update(void);
+void sim868_signal_sample_done( unsigned char code );
 
 void sim868_get_char(char *data);
 void sim868_print_char(char data);
+void sim868_tx_put( const char* data, unsigned int len );
+unsigned char sim868_tx_busy(void);
+void sim868_tx_flush(void);
+void sim868_tx_char( char data );
+void sim868_rx_put( char data );
+void sim868_rx_ring_put( char data );
+unsigned char sim868_nmea_divert( char data );
+unsigned char sim868_mux_crc( unsigned char crc, unsigned char data );
+void sim868_mux_rx_put( unsigned char data );
+void sim868_mux_frame(void);
+void sim868_mux_control( const unsigned char* data, unsigned char len );
+void sim868_mux_ring_put( unsigned char channel, char data );
+void sim868_mux_frame_print( unsigned char dlci, unsigned char control, const unsigned char* data, unsigned char len );
+unsigned char sim868_mux_open( unsigned char dlci );
+unsigned char sim868_mux_nmea_reply(void);
+unsigned char sim868_mux_char( unsigned char channel, char data );
+unsigned char sim868_mux_progmem_write( unsigned char channel, const char* data );
+void sim868_mux_flush(void);
+void sim868_mux_tx_reset(void);
+void sim868_mux_update(void);
 
-unsigned char sim868_http_read(unsigned int responce_len, unsigned int time_data_wait);
 unsigned char sim868_write_buff(unsigned int write_len, unsigned int timeout);
-unsigned char sim868_http_action(unsigned int *responce_len);
-unsigned char sim868_http_init(const char* host, const char* path, const char* params);
 unsigned char sim868_http_close(void);
-unsigned char sim868_gprs_init(void);
-unsigned char sim868_gprs_init_base(void);
 unsigned char sim868_gprs_close(void);
-unsigned char sim868_gsm_check(void);
 
 unsigned char sim868_command_responce(const char* command, const char* responce);
-unsigned char sim868_command_responce_http(const char* command, const char* responce);
-unsigned char sim868_command_responce_http_para(const char* command, const char* responce);
-void sim868_wait_responce_begin (const char* responce);
-unsigned char sim868_wait_responce_end (unsigned int timeout, unsigned char lineout);
+unsigned char sim868_command_id_wait( unsigned char id );
+unsigned char sim868_command_wait( const sim868_command_t* command );
+void sim868_pause( unsigned int ticks );
+void sim868_command_wait_done( unsigned char code );
+void sim868_command_update(void);
+void sim868_command_begin( const sim868_command_t* command );
+void sim868_command_end(void);
+unsigned char sim868_command_put_next( const sim868_command_t* command );
+unsigned char sim868_command_line_len( unsigned char id );
+const char* sim868_command_line( unsigned char id );
+unsigned char sim868_batch_joinable( const sim868_command_t* command );
+void sim868_batch_print(void);
+void sim868_batch_done( unsigned char code );
+void sim868_batch_next(void);
+void sim868_batch_step_done( unsigned char code );
+void sim868_batch_end( unsigned char code );
+void sim868_match_begin( const sim868_command_t* command );
+void sim868_match_put( char data );
+void sim868_match_line_end(void);
+unsigned int sim868_rx_read( char* data, unsigned int len, unsigned int* lines );
+unsigned char sim868_rx_line_get( char* line, unsigned char size );
+unsigned int sim868_rx_buf_update(void);
+unsigned int sim868_rx_data_update( const sim868_command_t* command );
+void sim868_unsolicited_update(void);
+void sim868_http_url_print(void);
+void sim868_http_content_print(void);
+unsigned int sim868_http_url_crc( const char* host, const char* path, const char* params );
+unsigned int sim868_crc16_chararr( unsigned int crc, const char* data );
+unsigned int sim868_crc16_block( unsigned int crc, const void* data, unsigned int len );
+unsigned int sim868_crc16_put( unsigned int crc, unsigned char data );
+void sim868_session_update(void);
+void sim868_session_close_put(void);
+void sim868_request_update(void);
+void sim868_request_fail(void);
+unsigned char sim868_request_cancel( sim868_request_callback_t callback );
+unsigned char sim868_request_ready( const sim868_request_t* request );
+unsigned char sim868_request_due(void);
+void sim868_request_step(void);
+void sim868_request_step_done( unsigned char code );
+void sim868_request_end( unsigned char code );
+unsigned char sim868_request_para_batch(void);
+const char* sim868_request_content(void);
+void sim868_request_para_done( unsigned char code );
+void sim868_request_wait_done( unsigned char code, unsigned int responce_len );
+unsigned char sim868_request_queue_put( const char* host, const char* path, const char* params, const sim868_body_t* body, const sim868_sink_t* sink, sim868_request_callback_t callback );
+unsigned char sim868_request_queue_send( const char* host, const char* path, const char* params, const sim868_body_t* body, unsigned int *responce_len );
+unsigned char sim868_request_requeue(void);
+unsigned char sim868_request_retry_class(void);
+void sim868_request_data_print(void);
+void sim868_request_body_print(void);
+unsigned int sim868_request_read_window(void);
+void sim868_request_read_print(void);
+void sim868_request_stat_put( unsigned long ticks, unsigned char code );
+unsigned int sim868_responce_uint(void);
+unsigned int sim868_request_http_status(void);
+unsigned char sim868_socket_op_begin( unsigned char op, sim868_socket_callback_t callback );
+void sim868_socket_step(void);
+void sim868_socket_step_done( unsigned char code );
+void sim868_socket_end( unsigned char code );
+void sim868_socket_unsolicited( unsigned char id, const char* line, unsigned char len );
+void sim868_socket_mode_print(void);
+void sim868_socket_apn_print(void);
+void sim868_socket_start_print(void);
+void sim868_socket_len_print(void);
+void sim868_socket_data_print(void);
+void sim868_socket_escape_print(void);
+unsigned char sim868_line_starts( const char* line, unsigned char len, const char* text );
+void sim868_nmea_begin(void);
+void sim868_nmea_put( char ch );
+void sim868_nmea_field_begin(void);
+void sim868_nmea_field_end(void);
+void sim868_nmea_end(void);
+void sim868_nmea_snapshot( sim868_nmea_raw_t* raw );
+long sim868_nmea_degrees( long value );
+unsigned char sim868_fix_fetch( sim868_fix_t* fix );
+void sim868_fix_predict( sim868_fix_t* fix, unsigned long ticks );
+int sim868_sin( long angle );
+long sim868_fix_seconds( const sim868_fix_t* fix );
+unsigned char sim868_varint_put( unsigned char* data, long value );
+void sim868_track_save(void);
+void sim868_track_update(void);
+char sim868_track_source( unsigned int offset );
+void sim868_track_upload_done( unsigned char code, unsigned int responce_len );
+unsigned char sim868_outbox_record_len( unsigned char slot );
+void sim868_outbox_update(void);
+char sim868_outbox_source( unsigned int offset );
+void sim868_outbox_upload_done( unsigned char code, unsigned int responce_len );
+void sim868_outbox_reclaim(void);
+void sim868_baudrate_set( unsigned long baudrate );
+unsigned char sim868_baudrate_accurate( unsigned long baudrate );
+unsigned char sim868_baudrate_probe(void);
+unsigned char sim868_baudrate_sync(void);
+unsigned char sim868_baudrate_negotiate(void);
+void sim868_baudrate_ipr_print(void);
 
 void sim868_delay(unsigned int delay_time);
 void sim868_buffer_print(char *buffer, unsigned int start_point, unsigned int end_point);
 
-void reset(void);
 
 
+//URC prefixes, the first matching entry is taken, so longer prefixes go first
+typedef struct
+{
+	const char*   text;
+	unsigned char id;
+	sim868_urc_callback_t handler;	//driver handler, may be 0
+} sim868_urc_t;
+
+const sim868_urc_t sim868_urc_table[] PROGMEM =
+{
+	{ sim868_urc__rdy,				SIM868_URC_RDY,				sim868_power_unsolicited },
+	{ sim868_urc__cfun,				SIM868_URC_CFUN,			sim868_power_unsolicited },
+	{ sim868_urc__cpin,				SIM868_URC_CPIN,			sim868_power_unsolicited },
+	{ sim868_urc__call_ready,		SIM868_URC_CALL_READY,		sim868_power_unsolicited },
+	{ sim868_urc__sms_ready,		SIM868_URC_SMS_READY,		sim868_power_unsolicited },
+	{ sim868_urc__power_down,		SIM868_URC_POWER_DOWN,		sim868_power_unsolicited },
+	{ sim868_urc__under_voltage,	SIM868_URC_UNDER_VOLTAGE,	0 },
+	{ sim868_urc__over_voltage,		SIM868_URC_OVER_VOLTAGE,	0 },
+	{ sim868_urc__creg,				SIM868_URC_CREG,			sim868_reg_unsolicited },
+	{ sim868_urc__csq,				SIM868_URC_CSQ,				sim868_signal_unsolicited },
+	{ sim868_urc__cmti,				SIM868_URC_CMTI,			0 },
+	{ sim868_urc__pdp_deact,		SIM868_URC_PDP_DEACT,		sim868_urc_network },
+	{ sim868_urc__sapbr_deact,		SIM868_URC_BEARER_DEACT,	sim868_urc_network },
+	{ sim868_urc__ciprxget,			SIM868_URC_SOCKET_DATA,		sim868_socket_unsolicited },
+	{ sim868_urc__closed,			SIM868_URC_SOCKET_CLOSED,	sim868_socket_unsolicited },
+	{ sim868_urc__httpaction,		SIM868_URC_HTTPACTION,		0 },
+	{ sim868_command__at,			SIM868_URC_ECHO,			sim868_power_unsolicited },
+	{ sim868_data__ok,				SIM868_URC_OK,				sim868_power_unsolicited },
+};
+
+#define SIM868_URC_TABLE_SIZE			( sizeof(sim868_urc_table) / sizeof(sim868_urc_t) )
+
+sim868_urc_callback_t sim868_urc_callback;
+sim868_urc_stat_t sim868_urc_stat;
+
 
 
 
-void reset(void)
-{
-	//sim868_power_dis();
-	//sim868_power_en();
-	asm("jmp 0x0000");
-}
 
 void sim868_example_request(void)
 {	
-	if( sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) == GOOD_CODE  )
+	if( sim868_reg_registered() )
 	//if( sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE )
 	{
 		sim868_command_responce(sim868_command__at, sim868_data__ok);
@@ -94,524 +713,3866 @@ void sim868_example_request(void)
 
 
 
-unsigned char sim868_get_location( char* latitude, unsigned char* latitude_len, char* longtitude, unsigned char* longtitude_len )
+//Fresh fix from AT+CGNSINF, GOOD_CODE if it has a valid position
+unsigned char sim868_cgnsinf_get( sim868_fix_t* fix )
 {
-	sim868_command_responce( sim868_command__gnss_get_info, sim868_data__gnss_get_info );
-	sim868_write_buff(50, 300);
-	//sim868_buffer_print( sim868_buffer, 0, 50 );
+	unsigned int begin;
+	unsigned int end;
+	unsigned int wait;
 	
-	
-	*latitude_len = 1;
-	*longtitude_len = 1;
-	latitude[0] = '0';
-	longtitude[0] = '0';
-
-	if( sim868_buffer[0] == '1' ) //have fix position
+	sim868_retry_begin( SIM868_RETRY_GNSS );
+	while( sim868_command_id_wait( SIM868_CMD_GNSS_INFO ) )
 	{
-		unsigned char data_pointer = 0;		
-		unsigned char _latitude_len = 0;
-		unsigned char _longtitude_len = 0;
-		
-		for( unsigned char i = 21; i < 50; i++ )
-		{					
-			unsigned char ch;				
-			ch = sim868_buffer[i];	
-			
-			if( ch == ',' )
-			{
-				data_pointer++;
-				continue;
-			}
-			
-			switch( data_pointer )
-			{
-				case 0:					
-					latitude[ _latitude_len++ ] = ch;
-				break;
-				
-				case 1:
-					longtitude[ _longtitude_len++ ] = ch;
-				break;
-				
-				default:
-					*latitude_len = _latitude_len;
-					*longtitude_len = _longtitude_len;
-					
-					return GOOD_CODE;
-				break;
-			}				
-		}//for( unsigned char i = 20; i < 50; i++ )
-		
-	}//if( sim868_buffer[0] == '1' )	
+		if( !(wait = sim868_retry_next( SIM868_RETRY_GNSS )) )
+		{
+			fix->fix = 0;
+			fix->fields = 0;
+			return ERROR_CODE;
+		}
+		sim868_pause( wait );
+	}
+	sim868_retry_done( SIM868_RETRY_GNSS );
 	
-	return GOOD_CODE;
+	begin = sim868_responce_write_pointer_begin + 1;
+	end = begin;
+	while( (end < sim868_responce_buf_len) && (sim868_responce_buf[ end ] != '\r') && (sim868_responce_buf[ end ] != '\n') ) end++;
+	
+	return sim868_cgnsinf_parse( &sim868_responce_buf[ begin ], end - begin, fix );
 }
 
-
-
-unsigned char sim868_request_get_send( const char* host, const char* path, const char* params, unsigned int *responce_len )
+//Position as decimal degrees text, "0" without a fix, for callers of the old text interface
+unsigned char sim868_get_location( char* latitude, unsigned char* latitude_len, char* longtitude, unsigned char* longtitude_len )
 {
-	//sim868_print_newstr(); sim868_print_chararr(host); sim868_print_chararr(path); sim868_print_chararr(params); sim868_print_newstr();
+	sim868_fix_t fix;
 	
-	unsigned int resp_len=0;
-	*responce_len = 0;
+	if( sim868_cgnsinf_get( &fix ) ) fix.latitude = fix.longitude = 0;
 	
-	unsigned char recturn_code = GOOD_CODE;
+	*latitude_len = sim868_degrees_text( latitude, fix.latitude );
+	*longtitude_len = sim868_degrees_text( longtitude, fix.longitude );
 	
-	//_delay_ms(1000);
-	if( (recturn_code == GOOD_CODE) && ( sim868_gsm_check() )  ) recturn_code = ERROR_CODE;
-	if( (recturn_code == GOOD_CODE) && ( sim868_gprs_init() )  ) recturn_code = ERROR_CODE;	
-	if( (recturn_code == GOOD_CODE) && ( sim868_http_init(host, path, params) )  ) recturn_code = ERROR_CODE;	
-	if( (recturn_code == GOOD_CODE) && ( sim868_http_action(&resp_len) ) ) recturn_code = ERROR_CODE;
-	if( (recturn_code == GOOD_CODE) && ( sim868_http_read(resp_len + SIM868_HTTPREAD_HEADER_LEN + 5, 700) )  ) recturn_code = ERROR_CODE;	
+	return fix.fields ? GOOD_CODE : ERROR_CODE;	//no +CGNSINF line at all
+}
+
+
+
+unsigned char sim868_nmea_en(void)
+{
+	sim868_nmea_enabled = 1;
 	
-	if( recturn_code == GOOD_CODE )
+	if( sim868_command_id_wait( SIM868_CMD_GNSS_POWER_ON ) ||
+		sim868_command_id_wait( SIM868_CMD_GNSS_NMEA_ON ) )
 	{
-		*responce_len = resp_len;
-		for( unsigned int i=0; i<resp_len; i++ )
-		{
-			sim868_buffer[i] = sim868_responce_buf[ sim868_responce_write_pointer_begin+5+i ];
-		}
-		//sim868_buffer_print( sim868_buffer, 0, resp_len );
+		sim868_nmea_enabled = 0;
+		return ERROR_CODE;
 	}
 	
-	sim868_request_get_end();
-	
-	return recturn_code;
+	return GOOD_CODE;
 }
 
-unsigned char sim868_request_get_end(void)
+unsigned char sim868_nmea_dis(void)
 {
-	sim868_http_close();
-	sim868_gprs_close();
+	unsigned char code = sim868_command_id_wait( SIM868_CMD_GNSS_NMEA_OFF );
 	
-	return GOOD_CODE;
+	sim868_nmea_enabled = 0;	//after OK, sentences already sent are still taken out of the ring
+	
+	return code;
 }
 
-unsigned int sim868_buffer_to_uint( char *buffer_data, unsigned int start_pointer, unsigned int end_pointer )
+//Latest RMC and GGA merged, GOOD_CODE if it has a valid position
+unsigned char sim868_nmea_fix_get( sim868_fix_t* fix )
 {
-	if( end_pointer <= start_pointer ) return 0;
-	if( (end_pointer-start_pointer) > UINT_LEN ) return 0;
+	sim868_nmea_raw_t raw;
+	long value;
 	
-	unsigned int digit = 1;
-	unsigned int result = 0;	
-	unsigned int i = end_pointer;
+	sim868_nmea_snapshot( &raw );
 	
-	while( (i--) > start_pointer )	
+	*fix = (sim868_fix_t){ 0 };
+	fix->run = sim868_nmea_enabled;
+	fix->fix = raw.fix;
+	fix->fields = raw.fields & ~(1UL << SIM868_NMEA_FIELD_DATE);
+	
+	value = raw.time;
+	fix->millisecond = value % 1000;
+	value /= 1000;
+	fix->second = value % 100;
+	fix->minute = ( value / 100 ) % 100;
+	fix->hour = value / 10000;
+	
+	if( raw.fields & (1UL << SIM868_NMEA_FIELD_DATE) )
 	{
-		if( (buffer_data[i] > 47) && (buffer_data[i] < 58) ) 
-		{
-			result += ( buffer_data[i] - 48 ) * digit;
-			digit *= 10;
-		}
+		fix->day = raw.date / 10000;
+		fix->month = ( raw.date / 100 ) % 100;
+		fix->year = 2000 + raw.date % 100;
 	}
 	
-	return result;
+	fix->latitude = sim868_nmea_degrees( raw.latitude );
+	fix->longitude = sim868_nmea_degrees( raw.longitude );
+	fix->altitude = raw.altitude;
+	fix->speed = (unsigned long)raw.speed * 1852 / 1000;
+	fix->course = raw.course;
+	fix->hdop = raw.hdop;
+	fix->sats_gnss = raw.sats;
+	
+	if( fix->fix && (fix->fields & (1UL << SIM868_FIX_FIELD_LATITUDE)) && (fix->fields & (1UL << SIM868_FIX_FIELD_LONGITUDE)) ) return GOOD_CODE;
+	
+	return ERROR_CODE;
 }
 
-
-
-
-
-unsigned char sim868_http_read(unsigned int responce_len, unsigned int time_data_wait)
+void sim868_nmea_stat_get( sim868_nmea_stat_t* stat )
 {
-	sim868_command_responce_http(sim868_CmdHttpRead, sim868_RespHttpRead);	
-	//if( sim868_write_buff(responce_len, time_data_wait) ) return ERROR_CODE;
-	sim868_write_buff(responce_len, time_data_wait);
+	sim868_nmea_raw_t raw;
 	
-	return GOOD_CODE;
+	sim868_nmea_snapshot( &raw );
+	stat->sentences = raw.sentences;
+	stat->errors = raw.errors;
 }
 
-unsigned char sim868_write_buff(unsigned int write_len, unsigned int timeout)
+void sim868_nmea_snapshot( sim868_nmea_raw_t* raw )
 {
-	unsigned int tick = 0;	
-	while( tick++ < timeout )
-	{
-		if( write_len <= sim868_responce_buf_len )
-		{
-			sim868_responce_write_pointer_end = sim868_responce_buf_len;
-			break;
-		}
-		
-		_delay_ms( SIM868_TIMEOUT_TICK );
-	}
+	unsigned char seq;
 	
-	return GOOD_CODE;
+	do
+	{
+		seq = sim868_nmea_seq;
+		*raw = sim868_nmea_raw[ seq & 1 ];
+	} while( seq != sim868_nmea_seq );
 }
 
-unsigned char sim868_http_action(unsigned int *responce_len)
+//ddmm.mmmmm * 100000 to degrees * 1000000
+long sim868_nmea_degrees( long value )
 {
-	*responce_len = 0;
+	unsigned char negative = ( value < 0 );
 	
-	sim868_wait_responce_begin( sim868_RespHttpAct200 );
-	sim868_print_progmem( sim868_TextHttp );
-	sim868_print_progmem( sim868_CmdHttpAct );
+	if( negative ) value = -value;
+	value = ( value / 10000000 ) * 1000000 + ( value % 10000000 ) / 6;
 	
-	if( sim868_wait_responce_end(6000, 4) ) return ERROR_CODE;
-	sim868_responce_write_pointer_end = sim868_responce_buf_len;	
-	
-	*responce_len = sim868_buffer_to_uint( sim868_responce_buf, sim868_responce_write_pointer_begin+1, sim868_responce_write_pointer_end-1 );
-	
-	return GOOD_CODE;
+	return negative ? -value : value;
+}
+
+//Called from the usart ISR on '$' at a line start
+void sim868_nmea_begin(void)
+{
+	sim868_nmea_state = SIM868_NMEA_STATE_SENTENCE;
+	sim868_nmea_sentence = (sim868_nmea_raw_t){ 0 };
+	sim868_nmea_index = 0;
+	sim868_nmea_type = 0;
+	sim868_nmea_checksum = 0;
+	sim868_nmea_checksum_rx = 0;
+	sim868_nmea_checksum_digits = 0;
+	sim868_nmea_field_begin();
 }
 
-unsigned char sim868_http_init(const char* host, const char* path, const char* params)
+void sim868_nmea_put( char ch )
 {
-	if( sim868_command_responce_http( sim868_CmdHttpInit, sim868_data__ok ) )
+	if( ch == '\n' )
 	{
-		sim868_command_responce_http( sim868_CmdHttpTerm, sim868_data__ok );
-		if( sim868_command_responce_http( sim868_CmdHttpInit, sim868_data__ok ) )	return ERROR_CODE;
+		sim868_nmea_end();
+		return;
 	}
-	if( sim868_command_responce_http_para( sim868_CmdHttpParaCid1, sim868_data__ok ) ) return ERROR_CODE;
+	if( ch == '\r' ) return;
 	
-	sim868_wait_responce_begin( sim868_data__ok );
-	sim868_print_progmem( sim868_TextHttp );
-	sim868_print_progmem( sim868_TextPara );
-	sim868_print_progmem( sim868_CmdHttpParaUrl );
-	sim868_print_chararr( host );
-	sim868_print_chararr( path );
-	sim868_print_chararr( params );
-	sim868_print_progmem( sim868_CmdHttpParaUrlEnd );
+	if( sim868_nmea_state & SIM868_NMEA_STATE_CHECKSUM )
+	{
+		if( (ch >= '0') && (ch <= '9') ) ch -= '0';
+		else if( (ch >= 'A') && (ch <= 'F') ) ch -= 'A' - 10;
+		else return;
+		
+		sim868_nmea_checksum_rx = ( sim868_nmea_checksum_rx << 4 ) | ch;
+		sim868_nmea_checksum_digits++;
+		return;
+	}
 	
-	if (sim868_wait_responce_end(600, 2)) return ERROR_CODE;
+	if( ch == '*' )
+	{
+		sim868_nmea_field_end();
+		sim868_nmea_state |= SIM868_NMEA_STATE_CHECKSUM;
+		return;
+	}
 	
-	if (sim868_command_responce_http_para(sim868_CmdHttpParaContApl, sim868_data__ok)) return ERROR_CODE;
+	sim868_nmea_checksum ^= ch;
 	
-	return GOOD_CODE;
+	if( ch == ',' )
+	{
+		sim868_nmea_field_end();
+		sim868_nmea_index++;
+		sim868_nmea_field_begin();
+		return;
+	}
+	
+	if( !sim868_nmea_index )
+	{
+		sim868_nmea_type = ( sim868_nmea_type << 8 ) | (unsigned char)ch;
+		return;
+	}
+	
+	if( (ch >= 'A') && (ch <= 'Z') ) sim868_nmea_char = ch;
+	sim868_field_put( &sim868_nmea_field, ch );
 }
 
-unsigned char sim868_http_close(void)
+void sim868_nmea_field_begin(void)
 {
-	if( sim868_command_responce_http( sim868_CmdHttpTerm, sim868_data__ok) == GOOD_CODE  ) return GOOD_CODE;
+	unsigned char decimals = 0;
 	
-	if( (sim868_command_responce_http( sim868_CmdHttpInit, sim868_data__ok) != GOOD_CODE) && 
-		(sim868_command_responce_http( sim868_CmdHttpTerm, sim868_data__ok) != GOOD_CODE) ) return ERROR_CODE;
+	if( sim868_nmea_index < SIM868_NMEA_DECIMALS_SIZE )
+	{
+		if( sim868_nmea_type == SIM868_NMEA_TYPE_RMC ) decimals = pgm_read_byte( &sim868_nmea_rmc_decimals[ sim868_nmea_index ] );
+		if( sim868_nmea_type == SIM868_NMEA_TYPE_GGA ) decimals = pgm_read_byte( &sim868_nmea_gga_decimals[ sim868_nmea_index ] );
+	}
 	
-	return GOOD_CODE;
+	sim868_field_begin( &sim868_nmea_field, decimals );
+	sim868_nmea_char = 0;
 }
 
-unsigned char sim868_gprs_init(void)
+void sim868_nmea_field_end(void)
 {
-	if( sim868_gprs_init_base() )
+	sim868_nmea_raw_t* sentence = &sim868_nmea_sentence;
+	unsigned char present = ( sim868_nmea_field.digits != 0 );
+	long value = sim868_field_end( &sim868_nmea_field );
+	
+	if( !sim868_nmea_index )
+	{
+		sim868_nmea_type &= 0xFFFFFF;	//"GNRMC" and "GPRMC" are both RMC
+		return;
+	}
+	
+	if( sim868_nmea_type == SIM868_NMEA_TYPE_RMC )
 	{
-		if( (sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) == GOOD_CODE) ||
-			(sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) == GOOD_CODE) ||
-			(sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) == GOOD_CODE) )
+		switch( sim868_nmea_index )
 		{
-			return GOOD_CODE;
+			case 1: sentence->time = value;			if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_UTC;			break;
+			case 2: sentence->fix = ( sim868_nmea_char == 'A' );	sentence->fields |= 1UL << SIM868_FIX_FIELD_FIX;		break;
+			case 3: sentence->latitude = value;		if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_LATITUDE;		break;
+			case 4: if( sim868_nmea_char == 'S' ) sentence->latitude = -sentence->latitude;								break;
+			case 5: sentence->longitude = value;	if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_LONGITUDE;	break;
+			case 6: if( sim868_nmea_char == 'W' ) sentence->longitude = -sentence->longitude;							break;
+			case 7: sentence->speed = value;		if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_SPEED;		break;
+			case 8: sentence->course = value;		if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_COURSE;		break;
+			case 9: sentence->date = value;			if( present ) sentence->fields |= 1UL << SIM868_NMEA_FIELD_DATE;		break;
 		}
-		
-		reset();
-		
-		if( (sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) != GOOD_CODE) &&
-			(sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) != GOOD_CODE) &&
-			(sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) != GOOD_CODE) )
+	}
+	
+	if( sim868_nmea_type == SIM868_NMEA_TYPE_GGA )
+	{
+		switch( sim868_nmea_index )
 		{
-			return ERROR_CODE;
+			case 1: sentence->time = value;			if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_UTC;			break;
+			case 2: sentence->latitude = value;		if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_LATITUDE;		break;
+			case 3: if( sim868_nmea_char == 'S' ) sentence->latitude = -sentence->latitude;								break;
+			case 4: sentence->longitude = value;	if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_LONGITUDE;	break;
+			case 5: if( sim868_nmea_char == 'W' ) sentence->longitude = -sentence->longitude;							break;
+			case 6: sentence->fix = ( value != 0 );	if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_FIX;			break;
+			case 7: sentence->sats = value;			if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_SATS_GNSS;	break;
+			case 8: sentence->hdop = value;			if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_HDOP;			break;
+			case 9: sentence->altitude = value;		if( present ) sentence->fields |= 1UL << SIM868_FIX_FIELD_ALTITUDE;		break;
 		}
-		
-		return sim868_gprs_init_base();
 	}
-	
-	return GOOD_CODE;
 }
 
-unsigned char sim868_gprs_init_base(void)
+//Merges a sentence with a good checksum into the latest fix and publishes it
+void sim868_nmea_end(void)
 {
-	if( sim868_command_responce(sim868_CmdSapbr31Gprs, sim868_data__ok) &&
-		sim868_command_responce(sim868_CmdSapbr31Gprs, sim868_data__ok) ) return ERROR_CODE;
+	sim868_nmea_state = SIM868_NMEA_STATE_LINE_START;
+	
+	if( (sim868_nmea_type != SIM868_NMEA_TYPE_RMC) && (sim868_nmea_type != SIM868_NMEA_TYPE_GGA) ) return;
 	
-	_delay_ms(200);
-	if( sim868_command_responce(sim868_CmdSapbrGprs11, sim868_data__ok) == GOOD_CODE ) 
+	if( (sim868_nmea_checksum_digits != 2) || (sim868_nmea_checksum_rx != sim868_nmea_checksum) )
 	{
-		_delay_ms(200);
-		return GOOD_CODE;
+		sim868_nmea_work.errors++;
 	}
-	_delay_ms(200);
-	sim868_command_responce(sim868_CmdSapbrGprs01, sim868_data__ok);
-	_delay_ms(200);
-	if( sim868_command_responce(sim868_CmdSapbrGprs11, sim868_data__ok) != GOOD_CODE ) 
+	else
 	{
-		_delay_ms(200);
-		return ERROR_CODE;
+		SIM868_NMEA_MERGE( time,		SIM868_FIX_FIELD_UTC );
+		SIM868_NMEA_MERGE( date,		SIM868_NMEA_FIELD_DATE );
+		SIM868_NMEA_MERGE( latitude,	SIM868_FIX_FIELD_LATITUDE );
+		SIM868_NMEA_MERGE( longitude,	SIM868_FIX_FIELD_LONGITUDE );
+		SIM868_NMEA_MERGE( altitude,	SIM868_FIX_FIELD_ALTITUDE );
+		SIM868_NMEA_MERGE( speed,		SIM868_FIX_FIELD_SPEED );
+		SIM868_NMEA_MERGE( course,		SIM868_FIX_FIELD_COURSE );
+		SIM868_NMEA_MERGE( hdop,		SIM868_FIX_FIELD_HDOP );
+		SIM868_NMEA_MERGE( fix,			SIM868_FIX_FIELD_FIX );
+		SIM868_NMEA_MERGE( sats,		SIM868_FIX_FIELD_SATS_GNSS );
+		sim868_nmea_work.fields |= sim868_nmea_sentence.fields;
+		sim868_nmea_work.sentences++;
 	}
 	
-	return GOOD_CODE;
+	sim868_nmea_raw[ (sim868_nmea_seq + 1) & 1 ] = sim868_nmea_work;
+	sim868_nmea_seq++;
 }
 
-unsigned char sim868_gprs_close(void)
+//Newest cached fix if it is not older than max_age ticks, moved by its speed and course to now,
+//otherwise a fresh one from NMEA or AT+CGNSINF
+unsigned char sim868_fix_get( sim868_fix_t* fix, unsigned long max_age )
 {
-	if( sim868_command_responce(sim868_CmdSapbrGprs01, sim868_data__ok) == GOOD_CODE ) 
+	if( sim868_fix_cache_count )
 	{
-		_delay_ms(200);
-		return GOOD_CODE;
+		sim868_fix_entry_t* entry = &sim868_fix_cache[ (sim868_fix_cache_head + SIM868_FIX_CACHE_SIZE - 1) % SIM868_FIX_CACHE_SIZE ];
+		unsigned long age = sim868_tick - entry->tick;
+		
+		if( age <= max_age )
+		{
+			*fix = entry->fix;
+			sim868_fix_cache_stat.hits++;
+			
+			if( age && (age <= SIM868_FIX_PREDICT_TICK) && (fix->speed >= SIM868_FIX_PREDICT_SPEED_MIN) && (fix->fields & (1UL << SIM868_FIX_FIELD_COURSE)) )
+			{
+				sim868_fix_predict( fix, age );
+				sim868_fix_cache_stat.predictions++;
+			}
+			
+			return GOOD_CODE;
+		}
 	}
-	_delay_ms(200);
-	sim868_command_responce(sim868_CmdSapbrGprs11, sim868_data__ok);
-	_delay_ms(200);
-	if( sim868_command_responce(sim868_CmdSapbrGprs01, sim868_data__ok) == GOOD_CODE ) 
+	
+	sim868_fix_cache_stat.misses++;
+	
+	if( sim868_fix_fetch( fix ) )
 	{
-		_delay_ms(200);
-		return GOOD_CODE;
+		sim868_fix_cache_stat.errors++;
+		return ERROR_CODE;
 	}
 	
-	return ERROR_CODE;
+	sim868_fix_cache[ sim868_fix_cache_head ].fix = *fix;
+	sim868_fix_cache[ sim868_fix_cache_head ].tick = sim868_tick;
+	sim868_fix_cache_head = ( sim868_fix_cache_head + 1 ) % SIM868_FIX_CACHE_SIZE;
+	if( sim868_fix_cache_count < SIM868_FIX_CACHE_SIZE ) sim868_fix_cache_count++;
+	
+	return GOOD_CODE;
 }
 
-unsigned char sim868_gsm_check(void)
+//index 0 is the newest, fix and tick as taken from the modem
+unsigned char sim868_fix_cache_get( unsigned char index, sim868_fix_t* fix, unsigned long* tick )
 {
-	if( (sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) == GOOD_CODE) ||
-		(sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) == GOOD_CODE) ||
-		(sim868_command_responce(sim868_CmdCReg, sim868_CmdCRegResp) == GOOD_CODE) ) 
-	{
-		return GOOD_CODE;
-	}
+	if( index >= sim868_fix_cache_count ) return ERROR_CODE;
 	
-	reset();
-		
-	return sim868_command_responce( sim868_CmdCReg, sim868_CmdCRegResp );
+	index = ( sim868_fix_cache_head + SIM868_FIX_CACHE_SIZE - 1 - index ) % SIM868_FIX_CACHE_SIZE;
+	*fix = sim868_fix_cache[ index ].fix;
+	*tick = sim868_fix_cache[ index ].tick;
 	
-	return ERROR_CODE;
+	return GOOD_CODE;
 }
 
+const sim868_fix_cache_stat_t* sim868_fix_cache_stat_get(void)
+{
+	return &sim868_fix_cache_stat;
+}
 
+//NMEA snapshot if sentences came since the last fetch, it costs no modem exchange
+unsigned char sim868_fix_fetch( sim868_fix_t* fix )
+{
+	if( sim868_nmea_enabled )
+	{
+		sim868_nmea_stat_t stat;
+		
+		sim868_nmea_stat_get( &stat );
+		if( stat.sentences != sim868_fix_cache_sentences )
+		{
+			sim868_fix_cache_sentences = stat.sentences;
+			if( sim868_nmea_fix_get( fix ) == GOOD_CODE ) return GOOD_CODE;
+		}
+	}
+	
+	return sim868_cgnsinf_get( fix );
+}
 
-unsigned char sim868_command_responce(const char* command, const char* responce)
+//Dead reckoning on a flat earth, UTC stays the time of the measurement
+void sim868_fix_predict( sim868_fix_t* fix, unsigned long ticks )
 {
-	sim868_wait_responce_begin( responce );	
+	unsigned long ms = ticks * SIM868_TIMEOUT_TICK;
+	long distance = (unsigned long)fix->speed * ms / 3600;	//cm
+	long north = distance * sim868_sin( fix->course + 900 ) / 11132;	//degrees * 1000000
+	long east = distance * sim868_sin( fix->course ) / 11132;
+	int lat_cos = sim868_sin( fix->latitude / 100000 + 900 );
 	
-	sim868_print_progmem( command );
+	if( lat_cos < 50 ) lat_cos = 50;
 	
-	return sim868_wait_responce_end(600, 2);
+	fix->latitude += north;
+	fix->longitude += east * 1000 / lat_cos;
 }
 
-unsigned char sim868_command_responce_http(const char* command, const char* responce)
+//angle is degrees * 10, result is sin() * 1000
+int sim868_sin( long angle )
 {
-	sim868_wait_responce_begin( responce );
+	unsigned char negative = 0;
+	unsigned char rest;
+	int value;
+	
+	angle %= 3600;
+	if( angle < 0 ) angle += 3600;
+	if( angle >= 1800 )
+	{
+		angle -= 1800;
+		negative = 1;
+	}
+	if( angle > 900 ) angle = 1800 - angle;
 	
-	sim868_print_progmem( sim868_TextHttp );
-	sim868_print_progmem( command );
+	rest = angle % 50;
+	value = pgm_read_word( &sim868_sin_table[ angle / 50 ] );
+	if( rest ) value += ( (int)pgm_read_word( &sim868_sin_table[ angle / 50 + 1 ] ) - value ) * rest / 50;
 	
-	return sim868_wait_responce_end(600, 2);
+	return negative ? -value : value;
 }
 
-unsigned char sim868_command_responce_http_para(const char* command, const char* responce)
+//Seconds from 2000-01-01 UTC, up to 2099
+long sim868_fix_seconds( const sim868_fix_t* fix )
 {
-	sim868_wait_responce_begin( responce );
+	unsigned int years = ( fix->year >= 2000 ) ? fix->year - 2000 : 0;
+	unsigned char month = ( (fix->month >= 1) && (fix->month <= 12) ) ? fix->month : 1;
+	long days = 365L * years + ( years + 3 ) / 4 + pgm_read_word( &sim868_month_days[ month - 1 ] ) + fix->day - 1;
 	
-	sim868_print_progmem( sim868_TextHttp );
-	sim868_print_progmem( sim868_TextPara );
-	sim868_print_progmem( command);
+	if( !(years % 4) && (month > 2) ) days++;
 	
-	return sim868_wait_responce_end(150, 2);
+	return ( ( days * 24 + fix->hour ) * 60 + fix->minute ) * 60 + fix->second;
 }
 
-void sim868_wait_responce_begin (const char* responce)
+//Zig-zag varint, up to 5 bytes, returns the length
+unsigned char sim868_varint_put( unsigned char* data, long value )
 {
-	_delay_ms(100);
-	
-	sim868_responce = responce;
-	sim868_responce_pointer = 0;
-	sim868_responce_line = 0;
+	unsigned long zigzag = ( (unsigned long)value << 1 ) ^ (unsigned long)( value >> 31 );
+	unsigned char len = 0;
 	
-	for(sim868_responce_len=0; (char)(pgm_read_byte( &responce[ sim868_responce_len ] )); sim868_responce_len++);
+	while( zigzag >= 0x80 )
+	{
+		data[ len++ ] = zigzag | 0x80;
+		zigzag >>= 7;
+	}
+	data[ len++ ] = zigzag;
 	
-	sim868_print_progmem( sim868_data__at_plus );	
+	return len;
 }
 
-unsigned char sim868_wait_responce_end (unsigned int timeout, unsigned char lineout)
+
+
+//Restores the points not uploaded before a reset, but the ones put after the last save, they go to host/path?params as one POST body
+void sim868_track_begin( const char* host, const char* path, const char* params )
 {
-	sim868_responce_buf_len = 0;
-	sim868_responce_write_pointer_begin = 0;
-	sim868_print_newstr();
+	sim868_track_host = host;
+	sim868_track_path = path;
+	sim868_track_params = params;
 	
-	unsigned int responce_buf_len_prev;
-	unsigned int responce_buf_p = 0;
-	unsigned int responce_buf_line_count = 0;
-	unsigned int responce_buf_lineout = lineout;
-	unsigned int tick = 0;
+	sim868_track_state = (sim868_track_state_t){ 0 };
+	sim868_track_state.magic = SIM868_TRACK_MAGIC;
+	sim868_track_slot = SIM868_TRACK_STATE_SLOTS - 1;
+	sim868_track_unsaved = 0;
+	sim868_track_dirty = 0;
 	
-	while( tick++ < timeout )
+	for( unsigned char i=0, found=0; i<SIM868_TRACK_STATE_SLOTS; i++ )
 	{
-		if( (responce_buf_line_count >= responce_buf_lineout ) ||
-			(sim868_responce_buf_len >= sim868_responce_buf_len_max) )
-		{
-			responce_buf_len_prev = sim868_responce_buf_len;
-			break;
-		}
+		sim868_track_state_t state;
 		
-		if( responce_buf_len_prev != sim868_responce_buf_len ) 
-		{
-			responce_buf_len_prev = sim868_responce_buf_len;
-			tick = 0;
-			
-			while( responce_buf_p < responce_buf_len_prev ) 
-			{
-				if( sim868_responce_buf[ responce_buf_p++ ] == '\n')
-				{
-					responce_buf_line_count++;
-				}
-			}			
+		eeprom_read_block( &state, &sim868_track_state_eeprom[i], sizeof(sim868_track_state_t) );
+		
+		if( state.magic != SIM868_TRACK_MAGIC ) continue;
+		if( state.crc != sim868_crc16_block( 0xFFFF, &state, offsetof( sim868_track_state_t, crc ) ) ) continue;
+		if( (state.start >= SIM868_TRACK_SIZE) || (state.len > SIM868_TRACK_SIZE) ) continue;
+		if( found && ((signed char)( state.seq - sim868_track_state.seq ) <= 0) ) continue;
+		
+		sim868_track_state = state;
+		sim868_track_slot = i;
+		found = 1;
+	}
+	
+	eeprom_read_block( sim868_track_buf, sim868_track_buf_eeprom, SIM868_TRACK_SIZE );
+	sim868_track_tick = sim868_tick;
+}
+
+//Ring bytes put since the last save first, then the state to the next slot in turn, so each
+//slot takes 1 / SIM868_TRACK_STATE_SLOTS of the writes and a saved state never points past them
+void sim868_track_save(void)
+{
+	if( sim868_track_dirty > sim868_track_state.len ) sim868_track_dirty = sim868_track_state.len;	//uploaded already
+	for( unsigned int i=sim868_track_state.len - sim868_track_dirty; i<sim868_track_state.len; i++ )
+	{
+		unsigned int offset = ( sim868_track_state.start + i ) % SIM868_TRACK_SIZE;
+		eeprom_update_byte( &sim868_track_buf_eeprom[ offset ], sim868_track_buf[ offset ] );
+	}
+	sim868_track_dirty = 0;
+	
+	sim868_track_state.seq++;
+	sim868_track_state.crc = sim868_crc16_block( 0xFFFF, &sim868_track_state, offsetof( sim868_track_state_t, crc ) );
+	sim868_track_slot = ( sim868_track_slot + 1 ) % SIM868_TRACK_STATE_SLOTS;
+	eeprom_update_block( &sim868_track_state, &sim868_track_state_eeprom[ sim868_track_slot ], sizeof(sim868_track_state_t) );
+	sim868_track_unsaved = 0;
+}
+
+unsigned char sim868_track_put( const sim868_fix_t* fix )
+{
+	sim868_track_point_t point;
+	unsigned char data[ SIM868_TRACK_HEAD_SIZE ];
+	unsigned char len;
+	
+	if( !fix->fix ) return ERROR_CODE;
+	
+	point.time = sim868_fix_seconds( fix );
+	point.latitude = fix->latitude;
+	point.longitude = fix->longitude;
+	
+	if( !sim868_track_state.count && !sim868_track_state.len && !sim868_track_state.base.time )
+	{
+		sim868_track_state.base = point;	//first point ever, it is sent as the reference and as a zero difference
+		sim868_track_state.last = point;
+	}
+	
+	len = sim868_varint_put( data, point.time - sim868_track_state.last.time );
+	len += sim868_varint_put( &data[ len ], point.latitude - sim868_track_state.last.latitude );
+	len += sim868_varint_put( &data[ len ], point.longitude - sim868_track_state.last.longitude );
+	
+	if( sim868_track_state.len + len > SIM868_TRACK_SIZE )
+	{
+		sim868_track_stat.dropped++;
+		return ERROR_CODE;
+	}
+	
+	if( !sim868_track_state.count ) sim868_track_tick = sim868_tick;
+	
+	//kept in RAM, written to EEPROM with the state by sim868_track_save()
+	for( unsigned char i=0; i<len; i++ ) sim868_track_buf[ ( sim868_track_state.start + sim868_track_state.len + i ) % SIM868_TRACK_SIZE ] = data[i];
+	
+	sim868_track_state.len += len;
+	sim868_track_dirty += len;
+	sim868_track_state.count++;
+	sim868_track_state.last = point;
+	if( ++sim868_track_unsaved >= SIM868_TRACK_SAVE_POINTS ) sim868_track_save();
+	
+	return GOOD_CODE;
+}
+
+unsigned int sim868_track_len_get(void)
+{
+	return sim868_track_state.len;
+}
+
+const sim868_track_stat_t* sim868_track_stat_get(void)
+{
+	return &sim868_track_stat;
+}
+
+void sim868_track_update(void)
+{
+	sim868_body_t body;
+	
+	if( sim868_track_uploading || !sim868_track_host || !sim868_track_state.count ) return;
+	if( (sim868_track_state.len < SIM868_TRACK_UPLOAD_SIZE) && (sim868_tick - sim868_track_tick < SIM868_TRACK_UPLOAD_TICK) ) return;
+	
+	sim868_track_upload = sim868_track_state;
+	sim868_track_head_len = sim868_varint_put( sim868_track_head, sim868_track_upload.base.time );
+	sim868_track_head_len += sim868_varint_put( &sim868_track_head[ sim868_track_head_len ], sim868_track_upload.base.latitude );
+	sim868_track_head_len += sim868_varint_put( &sim868_track_head[ sim868_track_head_len ], sim868_track_upload.base.longitude );
+	
+	body.data = 0;
+	body.len = sim868_track_head_len + sim868_track_upload.len;
+	body.type = SIM868_BODY_SOURCE;
+	body.source = sim868_track_source;
+	body.content = sim868_data__content_octet;
+	
+	if( sim868_request_post_put( sim868_track_host, sim868_track_path, sim868_track_params, &body, sim868_track_upload_done ) ) return;
+	sim868_request_defer( SIM868_TRACK_UPLOAD_DEADLINE );
+	
+	sim868_track_uploading = 1;
+}
+
+//Points put during the upload are after sim868_track_upload.len and are not sent
+char sim868_track_source( unsigned int offset )
+{
+	if( offset < sim868_track_head_len ) return sim868_track_head[ offset ];
+	
+	return sim868_track_buf[ ( sim868_track_upload.start + offset - sim868_track_head_len ) % SIM868_TRACK_SIZE ];
+}
+
+void sim868_track_upload_done( unsigned char code, unsigned int responce_len )
+{
+	unsigned int len = sim868_track_upload.len;
+	
+	sim868_track_uploading = 0;
+	
+	if( code )
+	{
+		sim868_track_stat.errors++;
+		sim868_track_tick = sim868_tick;	//next try after SIM868_TRACK_UPLOAD_TICK
+		return;
+	}
+	
+	sim868_track_stat.uploads++;
+	sim868_track_stat.points += sim868_track_upload.count;
+	sim868_track_stat.bytes += sim868_track_head_len + len;
+	
+	sim868_track_state.start = ( sim868_track_state.start + len ) % SIM868_TRACK_SIZE;
+	sim868_track_state.len -= len;
+	sim868_track_state.count -= sim868_track_upload.count;
+	sim868_track_state.base = sim868_track_upload.last;
+	sim868_track_tick = sim868_tick;
+	
+	sim868_track_save();	//acknowledged points are never sent again
+}
+
+//Finds the records not acknowledged before a reset, they go to host/path?params in batches of SIM868_OUTBOX_BATCH
+void sim868_outbox_begin( const char* host, const char* path, const char* params )
+{
+	unsigned int  seq;
+	unsigned int  seq_first = 0;
+	unsigned int  seq_last = 0;
+	unsigned char pending = 0;
+	unsigned char written = 0;
+	
+	sim868_outbox_host = host;
+	sim868_outbox_path = path;
+	sim868_outbox_params = params;
+	sim868_outbox_head = 0;
+	sim868_outbox_tail = 0;
+	
+	for( unsigned char i=0; i<SIM868_OUTBOX_SLOTS; i++ )
+	{
+		unsigned char mark = eeprom_read_byte( &sim868_outbox_eeprom[i].mark );
+		
+		if( (mark != SIM868_OUTBOX_PENDING) && (mark != SIM868_OUTBOX_DONE) ) continue;
+		eeprom_read_block( &seq, &sim868_outbox_eeprom[i].seq, sizeof(seq) );
+		
+		if( !written++ || ((int)( seq - seq_last ) > 0) )
+		{
+			seq_last = seq;
+			sim868_outbox_head = ( i + 1 ) % SIM868_OUTBOX_SLOTS;
+		}
+		
+		if( mark != SIM868_OUTBOX_PENDING ) continue;
+		if( !pending++ || ((int)( seq - seq_first ) < 0) )
+		{
+			seq_first = seq;
+			sim868_outbox_tail = i;
 		}
+	}
+	
+	sim868_outbox_seq = seq_last + 1;
+	if( !pending ) sim868_outbox_tail = sim868_outbox_head;
+	
+	//slots between the oldest pending one and the head, bad ones are reclaimed when their batch is
+	sim868_outbox_count = pending ? ( sim868_outbox_head + SIM868_OUTBOX_SLOTS - sim868_outbox_tail - 1 ) % SIM868_OUTBOX_SLOTS + 1 : 0;
+}
+
+//O(1), the record is kept until the host acknowledges it
+unsigned char sim868_outbox_put( const void* data, unsigned char len )
+{
+	sim868_outbox_slot_t* slot = &sim868_outbox_eeprom[ sim868_outbox_head ];
+	unsigned int crc;
+	
+	if( !len || (len > SIM868_OUTBOX_RECORD_SIZE) ) return ERROR_CODE;
+	if( sim868_outbox_count >= SIM868_OUTBOX_SLOTS )
+	{
+		sim868_outbox_stat.dropped++;
+		return ERROR_CODE;
+	}
+	
+	crc = sim868_crc16_block( 0xFFFF, &sim868_outbox_seq, sizeof(sim868_outbox_seq) );
+	crc = sim868_crc16_put( crc, len );
+	crc = sim868_crc16_block( crc, data, len );
+	
+	//slot is free or done, it is not taken as a record until the mark is written
+	eeprom_update_block( &sim868_outbox_seq, &slot->seq, sizeof(sim868_outbox_seq) );
+	eeprom_update_byte( &slot->len, len );
+	eeprom_update_block( data, slot->data, len );
+	eeprom_update_block( &crc, &slot->crc, sizeof(crc) );
+	eeprom_update_byte( &slot->mark, SIM868_OUTBOX_PENDING );
+	
+	sim868_outbox_seq++;
+	sim868_outbox_head = ( sim868_outbox_head + 1 ) % SIM868_OUTBOX_SLOTS;
+	sim868_outbox_count++;
+	sim868_outbox_stat.appended++;
+	if( sim868_outbox_count > sim868_outbox_stat.depth_max ) sim868_outbox_stat.depth_max = sim868_outbox_count;
+	
+	return GOOD_CODE;
+}
+
+unsigned char sim868_outbox_depth_get(void)
+{
+	return sim868_outbox_count;
+}
+
+const sim868_outbox_stat_t* sim868_outbox_stat_get(void)
+{
+	return &sim868_outbox_stat;
+}
+
+//Length of a pending record with a good checksum, 0 otherwise
+unsigned char sim868_outbox_record_len( unsigned char slot )
+{
+	sim868_outbox_slot_t* record = &sim868_outbox_eeprom[ slot ];
+	unsigned int  seq;
+	unsigned int  crc;
+	unsigned char len;
+	
+	if( eeprom_read_byte( &record->mark ) != SIM868_OUTBOX_PENDING ) return 0;
+	
+	len = eeprom_read_byte( &record->len );
+	if( !len || (len > SIM868_OUTBOX_RECORD_SIZE) ) return 0;
+	
+	eeprom_read_block( &seq, &record->seq, sizeof(seq) );
+	crc = sim868_crc16_block( 0xFFFF, &seq, sizeof(seq) );
+	crc = sim868_crc16_put( crc, len );
+	for( unsigned char i=0; i<len; i++ ) crc = sim868_crc16_put( crc, eeprom_read_byte( &record->data[i] ) );
+	
+	eeprom_read_block( &seq, &record->crc, sizeof(seq) );
+	
+	return ( crc == seq ) ? len : 0;
+}
+
+//Oldest records go first as one POST body of <len><data> pairs, once the module is registered
+void sim868_outbox_update(void)
+{
+	sim868_body_t body;
+	unsigned char slot = sim868_outbox_tail;
+	
+	if( sim868_outbox_uploading || !sim868_outbox_host || !sim868_outbox_count ) return;
+	if( !sim868_reg_registered() ) return;
+	if( sim868_outbox_tick && (sim868_tick - sim868_outbox_tick < SIM868_OUTBOX_RETRY_TICK) ) return;
+	
+	sim868_outbox_batch_bytes = 0;
+	for( sim868_outbox_batch=0; (sim868_outbox_batch < SIM868_OUTBOX_BATCH) && (sim868_outbox_batch < sim868_outbox_count); sim868_outbox_batch++ )
+	{
+		unsigned char len = sim868_outbox_record_len( slot );
+		
+		sim868_outbox_batch_len[ sim868_outbox_batch ] = len;
+		if( len ) sim868_outbox_batch_bytes += len + 1;
+		slot = ( slot + 1 ) % SIM868_OUTBOX_SLOTS;
+	}
+	
+	if( !sim868_outbox_batch_bytes )
+	{
+		sim868_outbox_reclaim();	//nothing readable in this batch
+		return;
+	}
+	
+	body.data = 0;
+	body.len = sim868_outbox_batch_bytes;
+	body.type = SIM868_BODY_SOURCE;
+	body.source = sim868_outbox_source;
+	body.content = sim868_data__content_octet;
+	
+	if( sim868_request_post_put( sim868_outbox_host, sim868_outbox_path, sim868_outbox_params, &body, sim868_outbox_upload_done ) ) return;
+	sim868_request_defer( SIM868_OUTBOX_DEADLINE );
+	
+	sim868_outbox_cursor = 0;
+	sim868_outbox_cursor_index = 0;
+	sim868_outbox_uploading = 1;
+}
+
+//Offsets come in order, from 0 again when the body is sent again
+char sim868_outbox_source( unsigned int offset )
+{
+	unsigned char len;
+	
+	if( offset < sim868_outbox_cursor )
+	{
+		sim868_outbox_cursor = 0;
+		sim868_outbox_cursor_index = 0;
+	}
+	
+	for( ;; )
+	{
+		len = sim868_outbox_batch_len[ sim868_outbox_cursor_index ];
+		if( len && (offset <= sim868_outbox_cursor + len) ) break;
+		
+		if( len ) sim868_outbox_cursor += len + 1;
+		sim868_outbox_cursor_index++;
+	}
+	
+	offset -= sim868_outbox_cursor;
+	if( !offset ) return len;
+	
+	return eeprom_read_byte( &sim868_outbox_eeprom[ ( sim868_outbox_tail + sim868_outbox_cursor_index ) % SIM868_OUTBOX_SLOTS ].data[ offset - 1 ] );
+}
+
+//Records put during the upload are after the batch and are not sent
+void sim868_outbox_upload_done( unsigned char code, unsigned int responce_len )
+{
+	sim868_outbox_uploading = 0;
+	
+	if( code )
+	{
+		sim868_outbox_stat.errors++;
+		sim868_outbox_tick = sim868_tick;	//next try after SIM868_OUTBOX_RETRY_TICK
+		return;
+	}
+	
+	sim868_outbox_tick = 0;
+	sim868_outbox_stat.batches++;
+	sim868_outbox_stat.bytes += sim868_outbox_batch_bytes;
+	sim868_outbox_reclaim();
+}
+
+//Marks the batch slots done, only after the host has acknowledged them
+void sim868_outbox_reclaim(void)
+{
+	for( unsigned char i=0; i<sim868_outbox_batch; i++ )
+	{
+		eeprom_update_byte( &sim868_outbox_eeprom[ sim868_outbox_tail ].mark, SIM868_OUTBOX_DONE );
+		
+		if( sim868_outbox_batch_len[i] ) sim868_outbox_stat.delivered++;
+		else sim868_outbox_stat.corrupt++;
+		
+		sim868_outbox_tail = ( sim868_outbox_tail + 1 ) % SIM868_OUTBOX_SLOTS;
+		sim868_outbox_count--;
+	}
+	
+	sim868_outbox_batch = 0;
+}
+
+
+//Blocking wrappers over the request queue, must not be called from a callback
+unsigned char sim868_request_get_send( const char* host, const char* path, const char* params, unsigned int *responce_len )
+{
+	return sim868_request_queue_send( host, path, params, 0, responce_len );
+}
+
+unsigned char sim868_request_post_send( const char* host, const char* path, const char* params, const sim868_body_t* body, unsigned int *responce_len )
+{
+	return sim868_request_queue_send( host, path, params, body, responce_len );
+}
+
+unsigned char sim868_request_queue_send( const char* host, const char* path, const char* params, const sim868_body_t* body, unsigned int *responce_len )
+{
+	unsigned long tick = sim868_tick;
+	
+	*responce_len = 0;
+	
+	while( sim868_request_queue_put( host, path, params, body, 0, sim868_request_wait_done ) )
+	{
+		if( sim868_tick - tick >= SIM868_REQUEST_SEND_TICK ) return ERROR_CODE;
+		sim868_update();
+		_delay_ms( SIM868_TIMEOUT_TICK );
+	}
+	
+	//a started request ends by itself, its commands time out and its retries have deadlines
+	sim868_request_wait_flag = 0;
+	while( !sim868_request_wait_flag )
+	{
+		if( (sim868_tick - tick >= SIM868_REQUEST_SEND_TICK) && (sim868_request_cancel( sim868_request_wait_done ) == GOOD_CODE) ) return ERROR_CODE;
+		sim868_update();
+		_delay_ms( SIM868_TIMEOUT_TICK );
+	}
+	
+	*responce_len = sim868_request_wait_len;
+	
+	return sim868_request_wait_code;
+}
+
+void sim868_request_wait_done( unsigned char code, unsigned int responce_len )
+{
+	sim868_request_wait_code = code;
+	sim868_request_wait_len = responce_len;
+	sim868_request_wait_flag = 1;
+}
+
+//Closes the HTTP service and the bearer now, otherwise they are closed after SIM868_SESSION_IDLE_TICK
+unsigned char sim868_request_get_end(void)
+{
+	if( sim868_request_busy() ) return ERROR_CODE;
+	if( !sim868_session_state ) return GOOD_CODE;
+	
+	sim868_http_close();
+	sim868_gprs_close();
+	sim868_session_state = 0;
+	
+	return GOOD_CODE;
+}
+
+//Strings and body must stay valid until the callback, requests run one after another through one bearer
+unsigned char sim868_request_put( const char* host, const char* path, const char* params, sim868_request_callback_t callback )
+{
+	return sim868_request_queue_put( host, path, params, 0, 0, callback );
+}
+
+unsigned char sim868_request_read_put( const char* host, const char* path, const char* params, const sim868_sink_t* sink, sim868_request_callback_t callback )
+{
+	return sim868_request_queue_put( host, path, params, 0, sink, callback );
+}
+
+unsigned char sim868_request_post_put( const char* host, const char* path, const char* params, const sim868_body_t* body, sim868_request_callback_t callback )
+{
+	if( !body || !body->len ) return ERROR_CODE;
+	
+	return sim868_request_queue_put( host, path, params, body, 0, callback );
+}
+
+unsigned char sim868_request_queue_put( const char* host, const char* path, const char* params, const sim868_body_t* body, const sim868_sink_t* sink, sim868_request_callback_t callback )
+{
+	if( sim868_request_queue_count >= SIM868_REQUEST_QUEUE_SIZE ) return ERROR_CODE;
+	
+	sim868_request_t* request = &sim868_request_queue[ sim868_request_queue_count++ ];
+	request->host = host;
+	request->path = path;
+	request->params = params;
+	request->body.len = 0;
+	request->body.content = 0;
+	if( body ) request->body = *body;
+	request->sink.data = sim868_buffer;
+	request->sink.size = SIM868_BUFFER_SIZE;
+	request->sink.callback = 0;
+	if( sink ) request->sink = *sink;
+	request->callback = callback;
+	request->tick = sim868_tick;
+	request->deadline = 0;
+	request->deferred = 0;
+	request->sent = 0;
+	
+	sim868_request_stat.depth = sim868_request_queue_count;
+	if( sim868_request_stat.depth > sim868_request_stat.depth_max ) sim868_request_stat.depth_max = sim868_request_stat.depth;
+	
+	return GOOD_CODE;
+}
+
+//Lets the last queued request wait up to deadline ticks for SIM868_SIGNAL_RSSI_MIN and SIM868_SIGNAL_BER_MAX
+unsigned char sim868_request_defer( unsigned long deadline )
+{
+	if( !sim868_request_queue_count ) return ERROR_CODE;
+	
+	sim868_request_queue[ sim868_request_queue_count - 1 ].deadline = deadline;
+	
+	return GOOD_CODE;
+}
+
+unsigned char sim868_request_busy(void)
+{
+	return sim868_request_queue_count + ( sim868_request_state != SIM868_REQUEST_STATE_IDLE );
+}
+
+unsigned char sim868_request_ready( const sim868_request_t* request )
+{
+	return !request->deadline || sim868_signal_good() || ( sim868_tick - request->tick >= request->deadline );
+}
+
+//Running request or a queued one not held for signal
+unsigned char sim868_request_due(void)
+{
+	if( sim868_request_state != SIM868_REQUEST_STATE_IDLE ) return 1;
+	
+	for( unsigned char i=0; i<sim868_request_queue_count; i++ )
+	{
+		if( sim868_request_ready( &sim868_request_queue[i] ) ) return 1;
+	}
+	
+	return 0;
+}
+
+//Ends every queued request with ERROR_CODE, callbacks may queue new ones
+void sim868_request_fail(void)
+{
+	unsigned char count = sim868_request_queue_count;
+	
+	while( count-- )
+	{
+		sim868_request_callback_t callback = sim868_request_queue[0].callback;
+		
+		for( unsigned char i=0; i+1<sim868_request_queue_count; i++ ) sim868_request_queue[i] = sim868_request_queue[i+1];
+		sim868_request_queue_count--;
+		sim868_request_stat.errors++;
+		sim868_signal_stat.failed++;
+		
+		if( callback ) callback( ERROR_CODE, 0 );
+	}
+	
+	sim868_request_stat.depth = sim868_request_queue_count;
+}
+
+//Takes a request not started yet out of the queue
+unsigned char sim868_request_cancel( sim868_request_callback_t callback )
+{
+	for( unsigned char i=0; i<sim868_request_queue_count; i++ )
+	{
+		if( sim868_request_queue[i].callback != callback ) continue;
+		
+		for( ; i+1<sim868_request_queue_count; i++ ) sim868_request_queue[i] = sim868_request_queue[i+1];
+		sim868_request_queue_count--;
+		sim868_request_stat.depth = sim868_request_queue_count;
+		
+		return GOOD_CODE;
+	}
+	
+	return ERROR_CODE;
+}
+
+//Starts the next queued request not held for signal, requests to the host of the previous one go first
+void sim868_request_update(void)
+{
+	if( (sim868_request_state != SIM868_REQUEST_STATE_IDLE) || !sim868_request_queue_count ) return;
+	
+	//module failed to start or was switched off, nothing brings it back outside of a recovery
+	if( ((sim868_power_state == SIM868_POWER_FAIL) || (sim868_power_state == SIM868_POWER_OFF)) && !sim868_recover_wait )
+	{
+		sim868_request_fail();
+		return;
+	}
+	if( (sim868_power_state != SIM868_POWER_READY) || sim868_recover_wait ) return;
+	
+	unsigned char index = SIM868_REQUEST_QUEUE_SIZE;
+	unsigned int host_crc;
+	
+	for( unsigned char i=0; i<sim868_request_queue_count; i++ )
+	{
+		if( !sim868_request_ready( &sim868_request_queue[i] ) ) continue;
+		if( index == SIM868_REQUEST_QUEUE_SIZE ) index = i;
 		
+		if( (sim868_request_group < SIM868_REQUEST_QUEUE_SIZE) && (sim868_crc16_chararr( 0xFFFF, sim868_request_queue[i].host ) == sim868_request_host_crc) )
+		{
+			index = i;
+			break;
+		}
+	}
+	if( index == SIM868_REQUEST_QUEUE_SIZE ) return;
+	
+	sim868_request = sim868_request_queue[ index ];
+	for( unsigned char i=index; i+1<sim868_request_queue_count; i++ )
+	{
+		sim868_request_queue[i] = sim868_request_queue[i+1];
+	}
+	sim868_request_queue_count--;
+	
+	host_crc = sim868_crc16_chararr( 0xFFFF, sim868_request.host );
+	if( host_crc == sim868_request_host_crc ) sim868_request_group++;
+	else sim868_request_group = 0;
+	sim868_request_host_crc = host_crc;
+	
+	sim868_request_stat.depth = sim868_request_queue_count;
+	sim868_request_stat.wait_total += sim868_tick - sim868_request.tick;
+	if( sim868_request.deferred ) sim868_signal_stat.deferred_ticks += sim868_tick - sim868_request.tick;
+	if( sim868_request.deadline && !sim868_signal_good() ) sim868_signal_stat.overrides++;
+	sim868_request.deadline = 0;	//a requeued request does not wait again
+	sim868_request_tick = sim868_tick;
+	sim868_request_tx_bytes = sim868_tx_bytes;
+	sim868_request_retry = 0;
+	sim868_request_status = 0;
+	sim868_request_read_total = 0;
+	sim868_request_read_offset = 0;
+	sim868_request_read_len = 0;
+	
+	sim868_request_step();
+}
+
+//Puts the next command of the request, skipping steps already done in this session
+void sim868_request_step(void)
+{
+	sim868_command_t command = { 0 };
+	command.callback = sim868_request_step_done;
+	command.responce = sim868_data__ok;
+	command.timeout = 600;
+	command.lineout = 2;
+	
+	for( ;; )
+	{
+		switch( ++sim868_request_state )
+		{
+			case SIM868_REQUEST_STATE_CREG:
+				if( sim868_reg_registered() ) continue;
+				sim868_command_load( &command, SIM868_CMD_CREG_QUERY );	//"+CREG: " goes to sim868_reg_unsolicited()
+				command.lineout = 4;	//empty line after "+CREG: " is counted too
+				sim868_reg.polls++;
+			break;
+			
+			case SIM868_REQUEST_STATE_BEARER_TYPE:
+				if( sim868_session_state & SIM868_SESSION_BEARER ) continue;
+				sim868_command_load( &command, SIM868_CMD_SAPBR_GPRS );
+			break;
+			
+			case SIM868_REQUEST_STATE_BEARER_OPEN:
+				if( sim868_session_state & SIM868_SESSION_BEARER ) continue;
+				sim868_command_load( &command, SIM868_CMD_SAPBR_OPEN );
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_INIT:
+				if( sim868_session_state & SIM868_SESSION_HTTP ) continue;
+				sim868_command_load( &command, SIM868_CMD_HTTP_INIT );
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_CID:
+				if( sim868_request_para_batch() == GOOD_CODE ) return;
+				if( sim868_session_state & SIM868_SESSION_HTTP_CID ) continue;
+				sim868_command_load( &command, SIM868_CMD_HTTP_CID );
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_URL:
+				sim868_request_url_crc = sim868_http_url_crc( sim868_request.host, sim868_request.path, sim868_request.params );
+				if( (sim868_session_state & SIM868_SESSION_HTTP_URL) && (sim868_request_url_crc == sim868_session_url_crc) ) continue;
+				sim868_http_host = sim868_request.host;
+				sim868_http_path = sim868_request.path;
+				sim868_http_params = sim868_request.params;
+				sim868_command_load( &command, SIM868_CMD_HTTP_URL );
+				command.print = sim868_http_url_print;
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_CONTENT:
+				sim868_http_content = sim868_request_content();
+				if( (sim868_session_state & SIM868_SESSION_HTTP_CONTENT) && (sim868_http_content == sim868_session_content) ) continue;
+				sim868_command_load( &command, SIM868_CMD_HTTP_CONTENT );
+				command.print = sim868_http_content_print;
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_DATA:
+				if( !sim868_request.body.len ) continue;
+				sim868_command_load( &command, SIM868_CMD_HTTP_DATA );
+				command.print = sim868_request_data_print;
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_BODY:
+				if( !sim868_request.body.len ) continue;
+				command.command = sim868_data__null;
+				command.print = sim868_request_body_print;
+				command.flags = SIM868_COMMAND_FLAG_RAW;
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_ACTION:
+				if( sim868_request.sent++ ) sim868_signal_stat.retransmitted += sim868_request.body.len;
+				sim868_command_load( &command, SIM868_CMD_HTTP_ACTION );
+				command.lineout = 4;
+				command.flags = SIM868_COMMAND_FLAG_DEFERRED;
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_READ:
+				sim868_request_read_len = sim868_request_read_window();
+				if( !sim868_request_read_len ) continue;
+				sim868_command_load( &command, SIM868_CMD_HTTP_READ );
+				command.print = sim868_request_read_print;
+				command.flags = SIM868_COMMAND_FLAG_BINARY;
+			break;
+			
+			case SIM868_REQUEST_STATE_HTTP_READ_DATA:
+				if( !sim868_request_read_len ) continue;
+				command.responce = 0;
+				command.flags = SIM868_COMMAND_FLAG_DATA;
+				command.data = sim868_request.sink.callback ? sim868_buffer : &sim868_request.sink.data[ sim868_request_read_offset ];
+				command.length = sim868_request_read_len;
+				command.timeout = 700;
+				command.lineout = 0;
+			break;
+			
+			default:
+				sim868_request_end( GOOD_CODE );
+			return;
+		}
+		break;
+	}
+	
+	if( !sim868_request_retry && (sim868_request_retry_class() != SIM868_RETRY_NONE) ) sim868_retry_begin( sim868_request_retry_class() );
+	
+	//body and HTTPREAD data follow their prompt before anything queued meanwhile
+	if( (sim868_request_state == SIM868_REQUEST_STATE_HTTP_BODY) || (sim868_request_state == SIM868_REQUEST_STATE_HTTP_READ_DATA) )
+	{
+		if( sim868_command_put_next( &command ) ) sim868_request_end( ERROR_CODE );
+	}
+	else if( sim868_command_put( &command ) ) sim868_request_end( ERROR_CODE );
+}
+
+//SIM868_RETRY_* of the current step, SIM868_RETRY_NONE if it is not retried
+unsigned char sim868_request_retry_class(void)
+{
+	switch( sim868_request_state )
+	{
+		case SIM868_REQUEST_STATE_CREG:			return SIM868_RETRY_REG;
+		case SIM868_REQUEST_STATE_BEARER_OPEN:	return SIM868_RETRY_BEARER;
+		case SIM868_REQUEST_STATE_HTTP_INIT:
+		case SIM868_REQUEST_STATE_HTTP_ACTION:	return SIM868_RETRY_HTTP;
+	}
+	
+	return SIM868_RETRY_NONE;
+}
+
+//HTTPPARA CID, URL and CONTENT still to be set go on one line
+unsigned char sim868_request_para_batch(void)
+{
+	sim868_command_t commands[3] = { { 0 } };
+	unsigned char count = 0;
+	
+	sim868_request_url_crc = sim868_http_url_crc( sim868_request.host, sim868_request.path, sim868_request.params );
+	sim868_request_para = 0;
+	
+	if( !(sim868_session_state & SIM868_SESSION_HTTP_CID) )
+	{
+		sim868_command_load( &commands[ count++ ], SIM868_CMD_HTTP_CID );
+		sim868_request_para |= SIM868_SESSION_HTTP_CID;
+	}
+	if( !(sim868_session_state & SIM868_SESSION_HTTP_URL) || (sim868_request_url_crc != sim868_session_url_crc) )
+	{
+		sim868_http_host = sim868_request.host;
+		sim868_http_path = sim868_request.path;
+		sim868_http_params = sim868_request.params;
+		sim868_command_load( &commands[ count ], SIM868_CMD_HTTP_URL );
+		commands[ count++ ].print = sim868_http_url_print;
+		sim868_request_para |= SIM868_SESSION_HTTP_URL;
+	}
+	sim868_http_content = sim868_request_content();
+	if( !(sim868_session_state & SIM868_SESSION_HTTP_CONTENT) || (sim868_http_content != sim868_session_content) )
+	{
+		sim868_command_load( &commands[ count ], SIM868_CMD_HTTP_CONTENT );
+		commands[ count++ ].print = sim868_http_content_print;
+		sim868_request_para |= SIM868_SESSION_HTTP_CONTENT;
+	}
+	if( count < 2 ) return ERROR_CODE;
+	
+	for( unsigned char i=0; i<count; i++ ) commands[i].lineout = 2;
+	
+	if( sim868_batch_put( commands, count, sim868_request_para_done ) ) return ERROR_CODE;
+	sim868_request_state = SIM868_REQUEST_STATE_HTTP_CONTENT;
+	
+	return GOOD_CODE;
+}
+
+void sim868_request_para_done( unsigned char code )
+{
+	if( code != GOOD_CODE )
+	{
+		sim868_request_end( ERROR_CODE );
+		return;
+	}
+	
+	sim868_session_state |= sim868_request_para;
+	if( sim868_request_para & SIM868_SESSION_HTTP_URL ) sim868_session_url_crc = sim868_request_url_crc;
+	if( sim868_request_para & SIM868_SESSION_HTTP_CONTENT ) sim868_session_content = sim868_http_content;
+	
+	sim868_request_retry = 0;
+	sim868_request_step();
+}
+
+//Type of the body, a GET keeps whatever the session has as it sends none
+const char* sim868_request_content(void)
+{
+	if( !sim868_request.body.len && (sim868_session_state & SIM868_SESSION_HTTP_CONTENT) ) return sim868_session_content;
+	if( sim868_request.body.len && sim868_request.body.content ) return sim868_request.body.content;
+	
+	return sim868_data__content_form;
+}
+
+void sim868_request_data_print(void)
+{
+	sim868_print_uint( sim868_request.body.len );
+	sim868_print_progmem( sim868_HttpDataDelay );
+}
+
+void sim868_request_body_print(void)
+{
+	sim868_body_t* body = &sim868_request.body;
+	
+	switch( body->type )
+	{
+		case SIM868_BODY_RAM:
+			sim868_print_chararr_by_len( (char*)body->data, body->len );
+		break;
+		
+		case SIM868_BODY_PROGMEM:
+			sim868_print_progmem_by_len( body->data, body->len );
+		break;
+		
+		case SIM868_BODY_SOURCE:
+			for( unsigned int i=0; i<body->len; i++ ) sim868_print_char( body->source(i) );
+		break;
+	}
+}
+
+void sim868_request_step_done( unsigned char code )
+{
+	sim868_command_t command = { 0 };
+	unsigned char retry = sim868_request_retry_class();
+	unsigned int wait;
+	
+	if( (sim868_request_state == SIM868_REQUEST_STATE_CREG) && !sim868_reg_registered() ) code = ERROR_CODE;
+	
+	//server answered, the modem and the network are fine, so no retry and no recovery
+	if( (code != GOOD_CODE) && (sim868_request_state == SIM868_REQUEST_STATE_HTTP_ACTION) && (sim868_request_status = sim868_request_http_status()) )
+	{
+		sim868_request_end( ERROR_CODE );
+		return;
+	}
+	
+	if( code != GOOD_CODE )
+	{
+		if( (retry == SIM868_RETRY_NONE) || !(wait = sim868_retry_next( retry )) )
+		{
+			sim868_request_end( ERROR_CODE );
+			return;
+		}
+		
+		//undo the half done step, then wait before it is sent again
+		sim868_command_load( &command, (sim868_request_state == SIM868_REQUEST_STATE_BEARER_OPEN) ? SIM868_CMD_SAPBR_CLOSE : SIM868_CMD_HTTP_TERM );
+		command.lineout = 2;
+		if( (sim868_request_state == SIM868_REQUEST_STATE_BEARER_OPEN) || (sim868_request_state == SIM868_REQUEST_STATE_HTTP_INIT) ) sim868_command_put( &command );
+		
+		command = (sim868_command_t){ 0 };
+		command.timeout = wait;
+		sim868_command_put( &command );
+		
+		sim868_request_retry++;
+		sim868_request_state--;
+		sim868_request_step();
+		return;
+	}
+	
+	if( retry != SIM868_RETRY_NONE ) sim868_retry_done( retry );
+	
+	switch( sim868_request_state )
+	{
+		case SIM868_REQUEST_STATE_BEARER_OPEN:
+			sim868_session_state |= SIM868_SESSION_BEARER;
+			sim868_request_stat.opens++;
+		break;
+		
+		case SIM868_REQUEST_STATE_HTTP_INIT:
+			sim868_session_state |= SIM868_SESSION_HTTP;
+			sim868_request_stat.opens++;
+		break;
+		
+		case SIM868_REQUEST_STATE_HTTP_CID:
+			sim868_session_state |= SIM868_SESSION_HTTP_CID;
+		break;
+		
+		case SIM868_REQUEST_STATE_HTTP_URL:
+			sim868_session_state |= SIM868_SESSION_HTTP_URL;
+			sim868_session_url_crc = sim868_request_url_crc;
+		break;
+		
+		case SIM868_REQUEST_STATE_HTTP_CONTENT:
+			sim868_session_state |= SIM868_SESSION_HTTP_CONTENT;
+			sim868_session_content = sim868_http_content;
+		break;
+		
+		case SIM868_REQUEST_STATE_HTTP_ACTION:
+			sim868_request_read_total = sim868_responce_uint();
+		break;
+		
+		case SIM868_REQUEST_STATE_HTTP_READ:
+			if( sim868_responce_uint() < sim868_request_read_len ) sim868_request_read_len = sim868_responce_uint();	//"+HTTPREAD: <len>", data follows
+		break;
+		
+		case SIM868_REQUEST_STATE_HTTP_READ_DATA:
+			if( sim868_request.sink.callback ) sim868_request.sink.callback( sim868_request_read_offset, sim868_buffer, sim868_request_read_len );
+			sim868_request_read_offset += sim868_request_read_len;
+			sim868_request_read_len = 0;
+			sim868_request_state = SIM868_REQUEST_STATE_HTTP_ACTION;	//next window
+		break;
+	}
+	
+	sim868_request_retry = 0;
+	sim868_request_step();
+}
+
+void sim868_request_end( unsigned char code )
+{
+	sim868_request_state = SIM868_REQUEST_STATE_IDLE;
+	sim868_request_stat_put( sim868_tick - sim868_request_tick, code );
+	sim868_request_stat.tx_bytes += sim868_tx_bytes - sim868_request_tx_bytes;
+	sim868_signal_stat.charge += ( sim868_tick - sim868_request_tick ) * SIM868_TIMEOUT_TICK * SIM868_REQUEST_CURRENT_MA / 1000;
+	sim868_session_idle_tick = 0;
+	
+	if( code == GOOD_CODE )
+	{
+		sim868_recover_end();
+		sim868_signal_stat.delivered++;
+		sim868_signal_stat.delivered_bytes += sim868_request.body.len;
+	}
+	else if( sim868_request_status )
+	{
+		sim868_recover_end();	//only modem and network failures move the ladder
+		sim868_request_read_offset = 0;
+		sim868_signal_stat.failed++;
+	}
+	else
+	{
+		//run again after the next ladder step, unless a sink already took a part of the body
+		if( !(sim868_request.sink.callback && sim868_request_read_offset) && (sim868_recover_escalate() == GOOD_CODE) && (sim868_request_requeue() == GOOD_CODE) ) return;
+		sim868_request_read_offset = 0;
+		sim868_signal_stat.failed++;
+	}
+	if( ((code != GOOD_CODE) && !sim868_request_status) || !SIM868_SESSION_IDLE_TICK ) sim868_session_close_put();
+	
+	if( sim868_request.callback ) sim868_request.callback( code, sim868_request_read_offset );
+}
+
+unsigned int sim868_request_status_get(void)
+{
+	return sim868_request_status;
+}
+
+//<status> of "+HTTPACTION: <method>,<status>,<len>" in the responce, 0 if there is none or it is a modem error (6xx)
+unsigned int sim868_request_http_status(void)
+{
+	unsigned int status = 0;
+	unsigned int i;
+	
+	for( i=0; i<sim868_responce_buf_len; i++ )
+	{
+		if( sim868_line_starts( &sim868_responce_buf[i], sim868_responce_buf_len - i, sim868_urc__httpaction ) ) break;
+	}
+	
+	for( i += sizeof(sim868_urc__httpaction) - 1; (i < sim868_responce_buf_len) && (sim868_responce_buf[i] != ','); i++ );
+	for( i++; (i < sim868_responce_buf_len) && (sim868_responce_buf[i] >= '0') && (sim868_responce_buf[i] <= '9'); i++ )
+	{
+		status = status * 10 + ( sim868_responce_buf[i] - '0' );
+	}
+	
+	return ( (status >= 100) && (status < 600) ) ? status : 0;
+}
+
+//Puts the current request back to the queue head
+unsigned char sim868_request_requeue(void)
+{
+	if( sim868_request_queue_count >= SIM868_REQUEST_QUEUE_SIZE ) return ERROR_CODE;
+	
+	for( unsigned char i=sim868_request_queue_count; i; i-- ) sim868_request_queue[i] = sim868_request_queue[i-1];
+	sim868_request_queue[0] = sim868_request;
+	sim868_request_queue_count++;
+	sim868_request_group = SIM868_REQUEST_QUEUE_SIZE;	//no host grouping for the next one
+	
+	return GOOD_CODE;
+}
+
+//Size of the next HTTPREAD window, 0 when the body is read or the caller buffer is full
+unsigned int sim868_request_read_window(void)
+{
+	unsigned int size;
+	
+	if( sim868_request_read_offset >= sim868_request_read_total ) return 0;
+	size = sim868_request_read_total - sim868_request_read_offset;
+	
+	if( sim868_request.sink.callback )
+	{
+		if( size > SIM868_HTTPREAD_WINDOW ) size = SIM868_HTTPREAD_WINDOW;
+	}
+	else
+	{
+		if( sim868_request_read_offset >= sim868_request.sink.size ) return 0;
+		if( size > sim868_request.sink.size - sim868_request_read_offset ) size = sim868_request.sink.size - sim868_request_read_offset;
+	}
+	
+	return size;
+}
+
+void sim868_request_read_print(void)
+{
+	sim868_print_char( '=' );
+	sim868_print_uint( sim868_request_read_offset );
+	sim868_print_char( ',' );
+	sim868_print_uint( sim868_request_read_len );
+}
+
+void sim868_request_stat_put( unsigned long ticks, unsigned char code )
+{
+	sim868_request_stat.count++;
+	if( code != GOOD_CODE ) sim868_request_stat.errors++;
+	sim868_request_stat.last = ticks;
+	sim868_request_stat.total += ticks;
+	if( ticks > sim868_request_stat.max ) sim868_request_stat.max = ticks;
+	if( !sim868_power_stat.first_request ) sim868_power_stat.first_request = sim868_tick - sim868_power_start_tick;
+}
+
+const sim868_request_stat_t* sim868_request_stat_get(void)
+{
+	return &sim868_request_stat;
+}
+
+unsigned long sim868_tick_get(void)
+{
+	return sim868_tick;
+}
+
+//Closes an idle session without blocking, from sim868_update()
+void sim868_session_update(void)
+{
+	if( !sim868_session_state || sim868_request_due() ) return;	//closed while requests wait for signal
+	if( ++sim868_session_idle_tick < SIM868_SESSION_IDLE_TICK ) return;
+	if( sim868_command_busy() ) return;
+	
+	sim868_session_close_put();
+}
+
+//Queues HTTPTERM and bearer close without waiting for them
+void sim868_session_close_put(void)
+{
+	sim868_command_t command = { 0 };
+	command.timeout = 600;
+	command.lineout = 2;
+	command.responce = sim868_data__ok;
+	
+	if( sim868_session_state & SIM868_SESSION_HTTP )
+	{
+		sim868_command_load( &command, SIM868_CMD_HTTP_TERM );
+		sim868_command_put( &command );
+	}
+	
+	if( sim868_session_state & SIM868_SESSION_BEARER )
+	{
+		sim868_command_load( &command, SIM868_CMD_SAPBR_CLOSE );
+		sim868_command_put( &command );
+	}
+	
+	sim868_session_state = 0;
+}
+
+//Number right after the matched responce
+unsigned int sim868_responce_uint(void)
+{
+	unsigned int end = sim868_responce_write_pointer_begin + 1;
+	
+	while( (end < sim868_responce_buf_len) && (sim868_responce_buf[ end ] >= '0') && (sim868_responce_buf[ end ] <= '9') ) end++;
+	
+	return sim868_buffer_to_uint( sim868_responce_buf, sim868_responce_write_pointer_begin + 1, end );
+}
+
+//Socket operations run one at a time as a chain of command callbacks, like requests
+unsigned char sim868_socket_open( unsigned char type, const char* host, unsigned int port, unsigned char transparent, sim868_socket_callback_t callback )
+{
+	if( sim868_socket_op != SIM868_SOCKET_OP_NONE ) return ERROR_CODE;
+	if( sim868_socket_state != SIM868_SOCKET_CLOSED ) return ERROR_CODE;
+	
+	sim868_socket_type = type;
+	sim868_socket_host = host;
+	sim868_socket_port = port;
+	sim868_socket_transparent = transparent;
+	sim868_socket_state = SIM868_SOCKET_OPENING;
+	
+	return sim868_socket_op_begin( SIM868_SOCKET_OP_OPEN, callback );
+}
+
+//Data must stay valid until the callback
+unsigned char sim868_socket_send( const char* data, unsigned int len, sim868_socket_callback_t callback )
+{
+	if( (sim868_socket_op != SIM868_SOCKET_OP_NONE) || (sim868_socket_state != SIM868_SOCKET_OPEN) || !len ) return ERROR_CODE;
+	
+	sim868_socket_data = (char*)data;
+	sim868_socket_len = len;
+	
+	return sim868_socket_op_begin( SIM868_SOCKET_OP_SEND, callback );
+}
+
+//Reads up to size received bytes, the callback gets the number of bytes stored
+unsigned char sim868_socket_receive( char* data, unsigned int size, sim868_socket_callback_t callback )
+{
+	if( (sim868_socket_op != SIM868_SOCKET_OP_NONE) || (sim868_socket_state != SIM868_SOCKET_OPEN) || !size ) return ERROR_CODE;
+	
+	sim868_socket_data = data;
+	sim868_socket_len = size;
+	
+	return sim868_socket_op_begin( SIM868_SOCKET_OP_RECEIVE, callback );
+}
+
+unsigned char sim868_socket_close( sim868_socket_callback_t callback )
+{
+	if( sim868_socket_op != SIM868_SOCKET_OP_NONE ) return ERROR_CODE;
+	if( sim868_socket_state == SIM868_SOCKET_CLOSED ) return ERROR_CODE;
+	
+	if( sim868_socket_state == SIM868_SOCKET_TRANSPARENT ) sim868_socket_state = SIM868_SOCKET_EXIT;
+	
+	return sim868_socket_op_begin( SIM868_SOCKET_OP_CLOSE, callback );
+}
+
+unsigned char sim868_socket_state_get(void)
+{
+	return sim868_socket_state;
+}
+
+//Set by "+CIPRXGET: 1", cleared by sim868_socket_receive()
+unsigned char sim868_socket_available(void)
+{
+	return sim868_socket_rx_flag;
+}
+
+//Transparent mode: bytes go to the UART as they are, the command queue is held
+unsigned int sim868_socket_write( const char* data, unsigned int len )
+{
+	if( sim868_socket_state != SIM868_SOCKET_TRANSPARENT ) return 0;
+	
+	sim868_print_chararr_by_len( (char*)data, len );
+	sim868_socket_stat.sent += len;
+	
+	return len;
+}
+
+unsigned int sim868_socket_read( char* data, unsigned int size )
+{
+	unsigned int count;
+	
+	if( sim868_socket_state != SIM868_SOCKET_TRANSPARENT ) return 0;
+	
+	count = sim868_rx_read( data, size, 0 );
+	sim868_socket_stat.received += count;
+	
+	return count;
+}
+
+const sim868_socket_stat_t* sim868_socket_stat_get(void)
+{
+	return &sim868_socket_stat;
+}
+
+unsigned char sim868_socket_op_begin( unsigned char op, sim868_socket_callback_t callback )
+{
+	sim868_socket_op = op;
+	sim868_socket_op_step = 0;
+	sim868_socket_callback = callback;
+	sim868_socket_tick = sim868_tick;
+	sim868_socket_tx_bytes = sim868_tx_bytes;
+	sim868_socket_result = 0;
+	
+	sim868_socket_step();
+	
+	return GOOD_CODE;
+}
+
+void sim868_socket_step(void)
+{
+	sim868_command_t command = { 0 };
+	command.callback = sim868_socket_step_done;
+	command.responce = sim868_data__ok;
+	command.timeout = 600;
+	command.lineout = 2;
+	
+	for( ;; )
+	{
+		switch( (sim868_socket_op << 4) | sim868_socket_op_step )
+		{
+			case (SIM868_SOCKET_OP_OPEN << 4) | 0:
+				sim868_command_load( &command, SIM868_CMD_CIPSHUT );
+			break;
+			
+			case (SIM868_SOCKET_OP_OPEN << 4) | 1:
+				sim868_command_load( &command, SIM868_CMD_CIPMUX );
+			break;
+			
+			case (SIM868_SOCKET_OP_OPEN << 4) | 2:
+				sim868_command_load( &command, SIM868_CMD_CIPMODE );
+				command.print = sim868_socket_mode_print;
+			break;
+			
+			case (SIM868_SOCKET_OP_OPEN << 4) | 3:
+				if( sim868_socket_transparent )
+				{
+					sim868_socket_op_step++;
+					continue;
+				}
+				sim868_command_load( &command, SIM868_CMD_CIPRXGET_MANUAL );
+			break;
+			
+			case (SIM868_SOCKET_OP_OPEN << 4) | 4:
+				sim868_command_load( &command, SIM868_CMD_CSTT );
+				command.print = sim868_socket_apn_print;
+			break;
+			
+			case (SIM868_SOCKET_OP_OPEN << 4) | 5:
+				sim868_command_load( &command, SIM868_CMD_CIICR );
+			break;
+			
+			case (SIM868_SOCKET_OP_OPEN << 4) | 6:
+				sim868_command_load( &command, SIM868_CMD_CIFSR );	//local IP address, no OK
+			break;
+			
+			case (SIM868_SOCKET_OP_OPEN << 4) | 7:
+				sim868_command_load( &command, SIM868_CMD_CIPSTART );
+				command.print = sim868_socket_start_print;
+				if( sim868_socket_transparent ) sim868_command_responce_set( &command, SIM868_RESP_CONNECT );
+				command.lineout = 4;
+				command.flags = SIM868_COMMAND_FLAG_DEFERRED;
+			break;
+			
+			case (SIM868_SOCKET_OP_SEND << 4) | 0:
+				sim868_command_load( &command, SIM868_CMD_CIPSEND );
+				command.print = sim868_socket_len_print;
+				command.flags = SIM868_COMMAND_FLAG_PROMPT;
+			break;
+			
+			case (SIM868_SOCKET_OP_SEND << 4) | 1:
+				command.command = sim868_data__null;
+				command.print = sim868_socket_data_print;
+				sim868_command_responce_set( &command, SIM868_RESP_SEND_OK );
+				command.timeout = 6000;
+				command.flags = SIM868_COMMAND_FLAG_RAW;
+			break;
+			
+			case (SIM868_SOCKET_OP_RECEIVE << 4) | 0:
+				sim868_socket_rx_flag = 0;
+				sim868_command_load( &command, SIM868_CMD_CIPRXGET_READ );
+				command.print = sim868_socket_len_print;
+				command.flags = SIM868_COMMAND_FLAG_BINARY;
+			break;
+			
+			case (SIM868_SOCKET_OP_RECEIVE << 4) | 1:
+				if( !sim868_socket_result )
+				{
+					sim868_socket_end( GOOD_CODE );
+					return;
+				}
+				command.command = 0;
+				command.responce = 0;
+				command.flags = SIM868_COMMAND_FLAG_DATA;
+				command.data = sim868_socket_data;
+				command.length = sim868_socket_result;
+				command.timeout = 700;
+				command.lineout = 0;
+			break;
+			
+			case (SIM868_SOCKET_OP_CLOSE << 4) | 0:
+				if( sim868_socket_state != SIM868_SOCKET_EXIT )
+				{
+					sim868_socket_op_step = 2;
+					continue;
+				}
+				command.command = 0;	//guard time before "+++"
+				command.responce = 0;
+				command.timeout = SIM868_SOCKET_ESCAPE_TICK;
+				command.lineout = 0;
+			break;
+			
+			case (SIM868_SOCKET_OP_CLOSE << 4) | 1:
+				command.command = sim868_data__null;
+				command.print = sim868_socket_escape_print;
+				command.timeout = 2 * SIM868_SOCKET_ESCAPE_TICK;
+				command.flags = SIM868_COMMAND_FLAG_RAW;
+			break;
+			
+			case (SIM868_SOCKET_OP_CLOSE << 4) | 2:
+				sim868_command_load( &command, SIM868_CMD_CIPCLOSE );
+			break;
+			
+			default:
+				sim868_socket_end( GOOD_CODE );
+			return;
+		}
+		break;
+	}
+	
+	//payload, CIPRXGET data and "+++" after its guard time follow the previous step before anything queued meanwhile
+	if( (sim868_socket_op != SIM868_SOCKET_OP_OPEN) && (sim868_socket_op_step == 1) )
+	{
+		if( sim868_command_put_next( &command ) ) sim868_socket_end( ERROR_CODE );
+	}
+	else if( sim868_command_put( &command ) ) sim868_socket_end( ERROR_CODE );
+}
+
+void sim868_socket_step_done( unsigned char code )
+{
+	if( code != GOOD_CODE )
+	{
+		//escape may be answered before the guard time is over, the close decides
+		if( (sim868_socket_op != SIM868_SOCKET_OP_CLOSE) || (sim868_socket_op_step != 1) )
+		{
+			sim868_socket_end( ERROR_CODE );
+			return;
+		}
+	}
+	
+	if( (sim868_socket_op == SIM868_SOCKET_OP_RECEIVE) && !sim868_socket_op_step )
+	{
+		sim868_socket_result = sim868_responce_uint();	//"+CIPRXGET: 2,<len>,<left>"
+		if( sim868_socket_result > sim868_socket_len ) sim868_socket_result = sim868_socket_len;
+	}
+	
+	sim868_socket_op_step++;
+	sim868_socket_step();
+}
+
+void sim868_socket_end( unsigned char code )
+{
+	unsigned char op = sim868_socket_op;
+	unsigned int len = 0;
+	sim868_socket_callback_t callback = sim868_socket_callback;
+	
+	sim868_socket_op = SIM868_SOCKET_OP_NONE;
+	sim868_socket_stat.tx_bytes += sim868_tx_bytes - sim868_socket_tx_bytes;
+	if( code != GOOD_CODE ) sim868_socket_stat.errors++;
+	
+	switch( op )
+	{
+		case SIM868_SOCKET_OP_OPEN:
+			if( code != GOOD_CODE )
+			{
+				sim868_socket_state = SIM868_SOCKET_CLOSED;
+				break;
+			}
+			sim868_socket_stat.opens++;
+			sim868_socket_state = sim868_socket_transparent ? SIM868_SOCKET_TRANSPARENT : SIM868_SOCKET_OPEN;
+		break;
+		
+		case SIM868_SOCKET_OP_SEND:
+			if( code != GOOD_CODE ) break;
+			len = sim868_socket_len;
+			sim868_socket_stat.sends++;
+			sim868_socket_stat.sent += len;
+			sim868_socket_stat.send_last = sim868_tick - sim868_socket_tick;
+			if( sim868_socket_stat.send_last > sim868_socket_stat.send_max ) sim868_socket_stat.send_max = sim868_socket_stat.send_last;
+		break;
+		
+		case SIM868_SOCKET_OP_RECEIVE:
+			if( code != GOOD_CODE ) break;
+			len = sim868_socket_result;
+			sim868_socket_stat.received += len;
+		break;
+		
+		case SIM868_SOCKET_OP_CLOSE:
+			sim868_socket_state = SIM868_SOCKET_CLOSED;
+		break;
+	}
+	
+	if( callback ) callback( code, len );
+}
+
+//"+CIPRXGET: 1" and "CLOSED" from sim868_urc_table
+void sim868_socket_unsolicited( unsigned char id, const char* line, unsigned char len )
+{
+	if( id == SIM868_URC_SOCKET_DATA ) sim868_socket_rx_flag = 1;
+	
+	if( (id == SIM868_URC_SOCKET_CLOSED) && (sim868_socket_state == SIM868_SOCKET_OPEN) )
+	{
+		sim868_socket_state = SIM868_SOCKET_CLOSED;
+	}
+}
+
+void sim868_socket_mode_print(void)
+{
+	sim868_print_char( '0' + sim868_socket_transparent );
+}
+
+void sim868_socket_apn_print(void)
+{
+	sim868_print_chararr( (char*)SIM868_APN );
+	sim868_print_progmem( sim868_CmdHttpParaUrlEnd );
+}
+
+//AT+CIPSTART="TCP","<host>","<port>"
+void sim868_socket_start_print(void)
+{
+	sim868_print_progmem( (sim868_socket_type == SIM868_SOCKET_UDP) ? sim868_data__udp : sim868_data__tcp );
+	sim868_print_progmem( sim868_data__quote_comma );
+	sim868_print_chararr( (char*)sim868_socket_host );
+	sim868_print_progmem( sim868_data__quote_comma );
+	sim868_print_uint( sim868_socket_port );
+	sim868_print_progmem( sim868_CmdHttpParaUrlEnd );
+}
+
+void sim868_socket_len_print(void)
+{
+	sim868_print_uint( sim868_socket_len );
+}
+
+void sim868_socket_data_print(void)
+{
+	sim868_print_chararr_by_len( sim868_socket_data, sim868_socket_len );
+}
+
+void sim868_socket_escape_print(void)
+{
+	sim868_print_progmem( sim868_data__escape );
+}
+
+//Line begins with a PROGMEM text
+unsigned char sim868_line_starts( const char* line, unsigned char len, const char* text )
+{
+	unsigned char i;
+	
+	for( i=0; (char)pgm_read_byte( &text[i] ); i++ )
+	{
+		if( (i >= len) || (line[i] != (char)pgm_read_byte( &text[i] )) ) return 0;
+	}
+	
+	return 1;
+}
+
+unsigned int sim868_buffer_to_uint( char *buffer_data, unsigned int start_pointer, unsigned int end_pointer )
+{
+	if( end_pointer <= start_pointer ) return 0;
+	if( (end_pointer-start_pointer) > UINT_LEN ) return 0;
+	
+	unsigned int digit = 1;
+	unsigned int result = 0;	
+	unsigned int i = end_pointer;
+	
+	while( (i--) > start_pointer )	
+	{
+		if( (buffer_data[i] > 47) && (buffer_data[i] < 58) ) 
+		{
+			result += ( buffer_data[i] - 48 ) * digit;
+			digit *= 10;
+		}
+	}
+	
+	return result;
+}
+
+
+
+
+
+unsigned char sim868_write_buff(unsigned int write_len, unsigned int timeout)
+{
+	sim868_command_t command = { 0 };
+	command.length = write_len;
+	command.timeout = timeout;
+	
+	sim868_command_wait( &command );
+	
+	return GOOD_CODE;
+}
+
+unsigned int sim868_http_url_crc( const char* host, const char* path, const char* params )
+{
+	unsigned int crc = 0xFFFF;
+	
+	crc = sim868_crc16_chararr( crc, host );
+	crc = sim868_crc16_chararr( crc, path );
+	crc = sim868_crc16_chararr( crc, params );
+	
+	return crc;
+}
+
+//CRC-16/CCITT
+unsigned int sim868_crc16_chararr( unsigned int crc, const char* data )
+{
+	for( unsigned int i=0; data[i]; i++ ) crc = sim868_crc16_put( crc, data[i] );
+	
+	return crc;
+}
+
+unsigned int sim868_crc16_block( unsigned int crc, const void* data, unsigned int len )
+{
+	for( unsigned int i=0; i<len; i++ ) crc = sim868_crc16_put( crc, ((const unsigned char*)data)[i] );
+	
+	return crc;
+}
+
+unsigned int sim868_crc16_put( unsigned int crc, unsigned char data )
+{
+	crc ^= (unsigned int)data << 8;
+	for( unsigned char bit=0; bit<8; bit++ )
+	{
+		if( crc & 0x8000 ) crc = (crc << 1) ^ 0x1021;
+		else crc <<= 1;
+	}
+	
+	return crc;
+}
+
+void sim868_http_url_print(void)
+{
+	sim868_print_chararr( (char*)sim868_http_host );
+	sim868_print_chararr( (char*)sim868_http_path );
+	sim868_print_chararr( (char*)sim868_http_params );
+	sim868_print_progmem( sim868_CmdHttpParaUrlEnd );
+}
+
+void sim868_http_content_print(void)
+{
+	sim868_print_progmem( sim868_http_content );
+	sim868_print_progmem( sim868_CmdHttpParaUrlEnd );
+}
+
+unsigned char sim868_http_close(void)
+{
+	sim868_session_state &= ~SIM868_SESSION_HTTP_ALL;
+	
+	if( sim868_command_id_wait( SIM868_CMD_HTTP_TERM ) == GOOD_CODE  ) return GOOD_CODE;
+	
+	if( (sim868_command_id_wait( SIM868_CMD_HTTP_INIT ) != GOOD_CODE) && 
+		(sim868_command_id_wait( SIM868_CMD_HTTP_TERM ) != GOOD_CODE) ) return ERROR_CODE;
+	
+	return GOOD_CODE;
+}
+
+unsigned char sim868_gprs_close(void)
+{
+	unsigned int wait;
+	
+	sim868_session_state &= ~SIM868_SESSION_BEARER;
+	
+	sim868_retry_begin( SIM868_RETRY_BEARER );
+	while( sim868_command_id_wait( SIM868_CMD_SAPBR_CLOSE ) != GOOD_CODE )
+	{
+		if( !(wait = sim868_retry_next( SIM868_RETRY_BEARER )) ) return ERROR_CODE;
+		sim868_pause( wait );
+		sim868_command_id_wait( SIM868_CMD_SAPBR_OPEN );	//a bearer left half open is closed after it is opened again
+	}
+	sim868_retry_done( SIM868_RETRY_BEARER );
+	sim868_pause( 200/SIM868_TIMEOUT_TICK );
+	
+	return GOOD_CODE;
+}
+
+
+
+unsigned char sim868_command_responce(const char* command, const char* responce)
+{
+	sim868_command_t descriptor = { 0 };
+	descriptor.command = command;
+	descriptor.responce = responce;
+	descriptor.timeout = 600;
+	descriptor.lineout = 2;
+	
+	return sim868_command_wait( &descriptor );
+}
+
+unsigned char sim868_command_id_wait( unsigned char id )
+{
+	sim868_command_t descriptor = { 0 };
+	sim868_command_load( &descriptor, id );
+	descriptor.lineout = 2;
+	
+	return sim868_command_wait( &descriptor );
+}
+
+
+
+unsigned char sim868_command_put( const sim868_command_t* command )
+{
+	if( sim868_command_queue_count >= SIM868_COMMAND_QUEUE_SIZE ) return ERROR_CODE;
+	
+	sim868_command_queue[ sim868_command_queue_head ] = *command;
+	if( ++sim868_command_queue_head >= SIM868_COMMAND_QUEUE_SIZE ) sim868_command_queue_head = 0;
+	sim868_command_queue_count++;
+	
+	return GOOD_CODE;
+}
+
+//Puts the command before all queued ones, from the callback of a finished command, which always finds a free place
+unsigned char sim868_command_put_next( const sim868_command_t* command )
+{
+	if( sim868_command_state != SIM868_COMMAND_STATE_IDLE ) return ERROR_CODE;	//would take the place of a running command
+	if( sim868_command_queue_count >= SIM868_COMMAND_QUEUE_SIZE ) return ERROR_CODE;
+	
+	if( !sim868_command_queue_tail ) sim868_command_queue_tail = SIM868_COMMAND_QUEUE_SIZE;
+	sim868_command_queue[ --sim868_command_queue_tail ] = *command;
+	sim868_command_queue_count++;
+	
+	return GOOD_CODE;
+}
+
+//Fills the command line, expected responce and timeout from sim868_command_table
+void sim868_command_load( sim868_command_t* command, unsigned char id )
+{
+	const sim868_command_line_t* line = &sim868_command_table[ id ];
+	
+	command->id = id;
+	command->prefix = 0;
+	command->command = (const char*)pgm_read_word( &line->text );
+	command->timeout = pgm_read_word( &line->timeout );
+	sim868_command_responce_set( command, pgm_read_byte( &line->responce ) );
+}
+
+void sim868_command_responce_set( sim868_command_t* command, unsigned char responce )
+{
+	command->responce = (const char*)pgm_read_word( &sim868_responce_table[ responce ].text );
+	command->responce_len = pgm_read_byte( &sim868_responce_table[ responce ].len );
+}
+
+unsigned char sim868_command_line_len( unsigned char id )
+{
+	return pgm_read_byte( &sim868_command_table[ id ].len );
+}
+
+const char* sim868_command_line( unsigned char id )
+{
+	return (const char*)pgm_read_word( &sim868_command_table[ id ].text );
+}
+
+unsigned char sim868_command_busy(void)
+{
+	return sim868_command_queue_count;
+}
+
+//Blocking wrapper over the queue, must not be called from a command callback
+unsigned char sim868_command_wait( const sim868_command_t* command )
+{
+	sim868_command_t descriptor = *command;
+	descriptor.callback = sim868_command_wait_done;
+	
+	while( sim868_command_put( &descriptor ) )
+	{
+		sim868_update();
+		_delay_ms( SIM868_TIMEOUT_TICK );
+	}
+	
+	sim868_command_wait_flag = 0;
+	while( !sim868_command_wait_flag )
+	{
+		sim868_update();
+		_delay_ms( SIM868_TIMEOUT_TICK );
+	}
+	
+	return sim868_command_wait_code;
+}
+
+void sim868_pause( unsigned int ticks )
+{
+	sim868_command_t command = { 0 };
+	command.timeout = ticks;
+	
+	sim868_command_wait( &command );
+}
+
+void sim868_command_wait_done( unsigned char code )
+{
+	sim868_command_wait_code = code;
+	sim868_command_wait_flag = 1;
+}
+
+//Each command callback gets its own result, callback gets ERROR_CODE if any of them failed;
+//command callbacks must not put commands, the batch may still be running
+unsigned char sim868_batch_put( const sim868_command_t* commands, unsigned char count, sim868_callback_t callback )
+{
+	sim868_command_t command = { 0 };
+	unsigned char joinable = ( count > 1 );
+	
+	if( sim868_batch_count || !count || (count > SIM868_BATCH_SIZE) ) return ERROR_CODE;
+	if( sim868_command_queue_count >= SIM868_COMMAND_QUEUE_SIZE ) return ERROR_CODE;
+	
+	for( unsigned char i=0; i<count; i++ )
+	{
+		sim868_batch[i] = commands[i];
+		command.timeout += commands[i].timeout;
+		if( !sim868_batch_joinable( &commands[i] ) ) joinable = 0;
+	}
+	sim868_batch_count = count;
+	sim868_batch_index = 0;
+	sim868_batch_code = GOOD_CODE;
+	sim868_batch_callback = callback;
+	sim868_batch_stat.commands += count;
+	
+	if( !joinable )
+	{
+		sim868_batch_next();
+		return GOOD_CODE;
+	}
+	
+	command.prefix = sim868_batch[0].prefix;
+	command.command = sim868_batch[0].command;
+	command.id = sim868_batch[0].id;
+	command.print = sim868_batch_print;
+	command.responce = sim868_data__ok;	//one OK for the line, ERROR stops at the failed command
+	command.callback = sim868_batch_done;
+	
+	sim868_command_put( &command );
+	sim868_batch_stat.lines++;
+	
+	return GOOD_CODE;
+}
+
+const sim868_batch_stat_t* sim868_batch_stat_get(void)
+{
+	return &sim868_batch_stat;
+}
+
+//Only commands answered with a bare OK can share a line
+unsigned char sim868_batch_joinable( const sim868_command_t* command )
+{
+	return command->command && ( command->responce == sim868_data__ok ) && !command->flags && !command->length;
+}
+
+void sim868_batch_print(void)
+{
+	for( unsigned char i=0; i<sim868_batch_count; i++ )
+	{
+		if( i )
+		{
+			sim868_print_progmem( sim868_data__batch );
+			if( sim868_batch[i].id ) sim868_print_progmem_by_len( sim868_batch[i].command + 3, sim868_command_line_len( sim868_batch[i].id ) - 3 );	//without "AT+"
+			else
+			{
+				if( sim868_batch[i].prefix ) sim868_print_progmem( sim868_batch[i].prefix );
+				sim868_print_progmem( sim868_batch[i].command );
+			}
+		}
+		if( sim868_batch[i].print ) sim868_batch[i].print();
+	}
+}
+
+void sim868_batch_done( unsigned char code )
+{
+	if( code != GOOD_CODE )
+	{
+		sim868_batch_stat.fallbacks++;
+		sim868_batch_next();
+		return;
+	}
+	
+	for( unsigned char i=0; i<sim868_batch_count; i++ )
+	{
+		if( sim868_batch[i].callback ) sim868_batch[i].callback( GOOD_CODE );
+	}
+	sim868_batch_end( GOOD_CODE );
+}
+
+void sim868_batch_next(void)
+{
+	sim868_command_t command;
+	
+	if( sim868_batch_index >= sim868_batch_count )
+	{
+		sim868_batch_end( sim868_batch_code );
+		return;
+	}
+	
+	command = sim868_batch[ sim868_batch_index ];
+	command.callback = sim868_batch_step_done;
+	if( sim868_command_put( &command ) ) sim868_batch_end( ERROR_CODE );
+}
+
+void sim868_batch_step_done( unsigned char code )
+{
+	sim868_callback_t callback = sim868_batch[ sim868_batch_index++ ].callback;
+	
+	if( code != GOOD_CODE ) sim868_batch_code = ERROR_CODE;
+	if( callback ) callback( code );
+	sim868_batch_next();
+}
+
+void sim868_batch_end( unsigned char code )
+{
+	sim868_batch_count = 0;
+	if( sim868_batch_callback ) sim868_batch_callback( code );
+}
+
+void sim868_command_update(void)
+{
+	if( sim868_socket_state == SIM868_SOCKET_TRANSPARENT ) return;	//UART carries socket data
+	if( sim868_mux_state == SIM868_MUX_STARTING ) return;			//AT channel is not open yet
+	
+	if( !sim868_command_queue_count )
+	{
+		sim868_unsolicited_update();
+		return;
+	}
+	
+	sim868_command_t* command = &sim868_command_queue[ sim868_command_queue_tail ];
+	
+	switch( sim868_command_state )
+	{
+		case SIM868_COMMAND_STATE_IDLE:
+			sim868_command_tick = 0;
+			sim868_command_line_count = 0;
+			sim868_match_flags = 0;
+			sim868_match_result = SIM868_MATCH_NONE;
+			sim868_command_length = command->length;
+			sim868_command_data_len = 0;
+			if( !(command->flags & SIM868_COMMAND_FLAG_DATA) ) sim868_rx_binary = 0;
+			if( command->command )
+			{
+				sim868_sleep_wake();
+				sim868_command_state = SIM868_COMMAND_STATE_GUARD;
+			}
+			else
+			{
+				sim868_command_state = SIM868_COMMAND_STATE_WAIT;
+			}
+		break;
+		
+		case SIM868_COMMAND_STATE_GUARD:
+			sim868_unsolicited_update();
+			if( ++sim868_command_tick < SIM868_COMMAND_GUARD_TICK ) break;
+			if( sim868_sleep_guard() ) break;
+			if( sim868_mux_tx_held ) break;			//frames of the last line are still held by flow control
+			
+			sim868_command_begin( command );
+			sim868_command_tick = 0;
+			sim868_command_state = SIM868_COMMAND_STATE_WAIT;
+		break;
+		
+		case SIM868_COMMAND_STATE_WAIT:
+			if( command->flags & SIM868_COMMAND_FLAG_DATA )
+			{
+				if( sim868_rx_data_update( command ) ) sim868_command_tick = 0;
+				
+				if( sim868_command_data_len >= command->length ) sim868_command_end();
+				else if( ++sim868_command_tick >= command->timeout ) sim868_command_end();
+				break;
+			}
+			
+			if( sim868_rx_buf_update() && command->command ) sim868_command_tick = 0;
+			if( sim868_tx_busy() ) sim868_command_tick = 0;	//timeout counts from the last byte sent
+			
+			if( (sim868_match_result != SIM868_MATCH_NONE) ||
+				(command->lineout && (sim868_command_line_count >= command->lineout)) ||
+				(command->length && (sim868_responce_buf_len >= command->length)) ||
+				(sim868_responce_buf_len >= sim868_responce_buf_len_max) )
+			{
+				sim868_command_end();
+				break;
+			}
+			
+			if( ++sim868_command_tick >= command->timeout ) sim868_command_end();
+		break;
+	}
+}
+
+void sim868_command_begin( const sim868_command_t* command )
+{
+	sim868_match_begin( command );
+	if( command->flags & SIM868_COMMAND_FLAG_BINARY ) sim868_rx_binary = 1;	//before the line goes out, data may follow its answer at once
+	
+	//ring is emptied before the first byte goes out, so nothing of the echo can be dropped
+	sim868_unsolicited_update();
+	if( !(command->flags & SIM868_COMMAND_FLAG_RAW) ) sim868_rx_read( 0, SIM868_RX_RING_SIZE, 0 );	//drop a line left without end, echo is dropped by the matcher
+	sim868_responce_buf_len = 0;
+	sim868_match_line_begin = 0;
+	sim868_responce_write_pointer_begin = 0;
+	
+	if( !(command->flags & SIM868_COMMAND_FLAG_RAW) )
+	{
+		if( command->id ) sim868_print_progmem_by_len( command->command, sim868_command_line_len( command->id ) );	//one block from flash
+		else
+		{
+			sim868_print_progmem( sim868_data__at_plus );
+			if( command->prefix ) sim868_print_progmem( command->prefix );
+			sim868_print_progmem( command->command );
+		}
+	}
+	if( command->print ) command->print();
+	if( !(command->flags & SIM868_COMMAND_FLAG_RAW) ) sim868_print_newstr();
+	sim868_mux_flush();
+}
+
+void sim868_command_end(void)
+{
+	sim868_command_t* command = &sim868_command_queue[ sim868_command_queue_tail ];
+	sim868_callback_t callback = command->callback;
+	unsigned char code = GOOD_CODE;
+	
+	if( sim868_match_result != SIM868_MATCH_NONE )
+	{
+		code = sim868_match_result;
+	}
+	else if( command->responce )
+	{
+		if( !(sim868_match_flags & SIM868_MATCH_FLAG_FOUND) ) code = ERROR_CODE;
+	}
+	else if( command->flags & SIM868_COMMAND_FLAG_DATA )
+	{
+		if( sim868_command_data_len < command->length ) code = ERROR_CODE;
+	}
+	else if( command->length )
+	{
+		if( sim868_responce_buf_len >= command->length ) sim868_responce_write_pointer_end = sim868_responce_buf_len;
+		else code = ERROR_CODE;
+	}
+	
+	if( !(command->flags & SIM868_COMMAND_FLAG_BINARY) || code ) sim868_rx_binary = 0;	//kept for the DATA command after a good header
+	
+	if( ++sim868_command_queue_tail >= SIM868_COMMAND_QUEUE_SIZE ) sim868_command_queue_tail = 0;
+	sim868_command_queue_count--;
+	sim868_command_state = SIM868_COMMAND_STATE_IDLE;
+	
+	if( callback ) callback( code );
+}
+
+void sim868_match_begin( const sim868_command_t* command )
+{
+	unsigned char k = 0;
+	
+	sim868_responce = command->responce;
+	sim868_responce_len = command->responce_len;
+	sim868_match_state = 0;
+	sim868_match_column = 0;
+	sim868_match_token = SIM868_TOKEN_NONE;
+	sim868_match_token_alive = ( 1UL << SIM868_TOKEN_TABLE_SIZE ) - 1;
+	sim868_match_flags = SIM868_MATCH_FLAG_ENABLED;
+	if( command->flags & SIM868_COMMAND_FLAG_DEFERRED ) sim868_match_flags |= SIM868_MATCH_FLAG_DEFERRED;
+	if( command->flags & SIM868_COMMAND_FLAG_PROMPT ) sim868_match_flags |= SIM868_MATCH_FLAG_PROMPT;
+	sim868_match_result = SIM868_MATCH_NONE;
+	
+	if( !sim868_responce ) return;
+	
+	//length comes from sim868_responce_table, counted only for descriptors built by hand
+	if( !sim868_responce_len ) while( (sim868_responce_len < SIM868_RESPONCE_PATTERN_SIZE) && (char)(pgm_read_byte( &sim868_responce[ sim868_responce_len ] )) ) sim868_responce_len++;
+	if( sim868_responce_len > SIM868_RESPONCE_PATTERN_SIZE ) sim868_responce_len = SIM868_RESPONCE_PATTERN_SIZE;
+	
+	//failure function of the expected responce, restart state after a mismatch
+	sim868_match_fail[0] = 0;
+	for( unsigned char i=1; i<sim868_responce_len; i++ )
+	{
+		char ch = pgm_read_byte( &sim868_responce[i] );
+		
+		while( k && (ch != (char)pgm_read_byte( &sim868_responce[k] )) ) k = sim868_match_fail[ k-1 ];
+		if( ch == (char)pgm_read_byte( &sim868_responce[k] ) ) k++;
+		sim868_match_fail[i] = k;
+	}
+}
+
+//Called for every byte stored to sim868_responce_buf, sets sim868_match_result on a terminal line
+void sim868_match_put( char data )
+{
+	if( !(sim868_match_flags & SIM868_MATCH_FLAG_ENABLED) || (sim868_match_result != SIM868_MATCH_NONE) ) return;
+	
+	if( sim868_responce_len && !(sim868_match_flags & SIM868_MATCH_FLAG_FOUND) )
+	{
+		while( sim868_match_state && (data != (char)pgm_read_byte( &sim868_responce[ sim868_match_state ] )) )
+		{
+			sim868_match_state = sim868_match_fail[ sim868_match_state-1 ];
+		}
+		if( data == (char)pgm_read_byte( &sim868_responce[ sim868_match_state ] ) ) sim868_match_state++;
+		
+		if( sim868_match_state >= sim868_responce_len )
+		{
+			sim868_match_flags |= SIM868_MATCH_FLAG_FOUND | SIM868_MATCH_FLAG_FOUND_LINE;
+			sim868_responce_write_pointer_begin = sim868_responce_buf_len - 1;
+			sim868_responce_write_pointer_end = sim868_responce_write_pointer_begin;
+			if( sim868_match_flags & SIM868_MATCH_FLAG_PROMPT ) sim868_match_result = GOOD_CODE;
+		}
+	}
+	
+	if( data == '\n' )
+	{
+		sim868_match_line_end();
+		return;
+	}
+	
+	if( sim868_match_token_alive )
+	{
+		for( unsigned char i=0; i<SIM868_TOKEN_TABLE_SIZE; i++ )
+		{
+			if( !(sim868_match_token_alive & (1UL << i)) ) continue;
+			
+			const char* text = (const char*)pgm_read_word( &sim868_token_table[i].text );
+			unsigned char len = pgm_read_byte( &sim868_token_table[i].len );
+			
+			if( data != (char)pgm_read_byte( &text[ sim868_match_column ] ) )
+			{
+				sim868_match_token_alive &= ~(1UL << i);
+			}
+			else if( sim868_match_column + 1 >= len )
+			{
+				sim868_match_token = pgm_read_byte( &sim868_token_table[i].code );
+				sim868_match_token_alive &= ~(1UL << i);
+			}
+		}
+	}
+	
+	if( sim868_match_column < 0xFF ) sim868_match_column++;
+}
+
+void sim868_match_line_end(void)
+{
+	unsigned char token = sim868_match_token;
+	unsigned char empty = ( sim868_match_column <= 1 );	//only '\r' before '\n'
+	
+	sim868_match_column = 0;
+	sim868_match_token = SIM868_TOKEN_NONE;
+	sim868_match_token_alive = ( 1UL << SIM868_TOKEN_TABLE_SIZE ) - 1;
+	
+	if( token == SIM868_TOKEN_ECHO )
+	{
+		//echo of the command, sent while the command is transmitted
+		sim868_match_flags &= ~( SIM868_MATCH_FLAG_FOUND | SIM868_MATCH_FLAG_FOUND_LINE );
+		sim868_responce_buf_len = sim868_match_line_begin;
+		sim868_match_state = 0;
+		if( sim868_command_line_count ) sim868_command_line_count--;
+		return;
+	}
+	
+	if( sim868_match_flags & SIM868_MATCH_FLAG_FOUND_LINE )
+	{
+		sim868_match_result = GOOD_CODE;
+		return;
+	}
+	
+	switch( token )
+	{
+		case SIM868_TOKEN_ERROR:
+			sim868_match_result = ERROR_CODE;
+		break;
+		
+		case SIM868_TOKEN_OK:
+			if( !sim868_responce_len ) sim868_match_result = GOOD_CODE;
+			else if( sim868_match_flags & SIM868_MATCH_FLAG_DEFERRED ) sim868_match_flags |= SIM868_MATCH_FLAG_OK;
+			else sim868_match_result = ERROR_CODE;
+		break;
+		
+		case SIM868_TOKEN_URC:
+			sim868_urc_stat.in_command++;
+			sim868_urc_dispatch( &sim868_responce_buf[ sim868_match_line_begin ], sim868_responce_buf_len - sim868_match_line_begin );
+			sim868_responce_buf_len = sim868_match_line_begin;	//not a part of the responce
+			sim868_match_state = 0;
+			if( sim868_command_line_count ) sim868_command_line_count--;
+		break;
+		
+		default:
+			//first line after OK of a deferred command is its result
+			if( !empty && (sim868_match_flags & SIM868_MATCH_FLAG_OK) ) sim868_match_result = ERROR_CODE;
+		break;
+	}
+	
+	sim868_match_line_begin = sim868_responce_buf_len;
+}
+
+unsigned int sim868_rx_read( char* data, unsigned int len, unsigned int* lines )
+{
+	unsigned int count = 0;
+	unsigned char tail = sim868_rx_tail;
+	unsigned char head = sim868_rx_head;
+	
+	while( (tail != head) && (count < len) )
+	{
+		if( (sim868_rx_line_tail != sim868_rx_line_head) && (sim868_rx_line_ring[ sim868_rx_line_tail ] == tail) )
+		{
+			sim868_rx_line_tail = (sim868_rx_line_tail + 1) & SIM868_RX_LINE_RING_MASK;
+			if( lines ) (*lines)++;
+		}
+		
+		if( data ) data[ count ] = sim868_rx_ring[ tail ];
+		count++;
+		tail = (tail + 1) & SIM868_RX_RING_MASK;
+	}
+	
+	sim868_rx_tail = tail;
+	
+	return count;
+}
+
+unsigned char sim868_rx_line_get( char* line, unsigned char size )
+{
+	if( sim868_rx_line_tail == sim868_rx_line_head ) return 0;
+	
+	unsigned int len = ( (sim868_rx_line_ring[ sim868_rx_line_tail ] - sim868_rx_tail) & SIM868_RX_RING_MASK ) + 1;
+	
+	if( len > size )
+	{
+		sim868_rx_read( line, size, 0 );
+		sim868_rx_read( 0, len - size, 0 );
+		return size;
+	}
+	
+	return sim868_rx_read( line, len, 0 );
+}
+
+unsigned char sim868_rx_lines(void)
+{
+	return (sim868_rx_line_head - sim868_rx_line_tail) & SIM868_RX_LINE_RING_MASK;
+}
+
+unsigned int sim868_rx_overflow_get(void)
+{
+	return sim868_rx_overflow;
+}
+
+unsigned int sim868_tx_overflow_get(void)
+{
+	return sim868_tx_overflow;
+}
+
+//Stops at the end of a terminal line or at the wanted length, the rest stays in the ring for the next command
+unsigned int sim868_rx_buf_update(void)
+{
+	unsigned int count = 0;
+	
+	while( (sim868_match_result == SIM868_MATCH_NONE) &&
+		   (sim868_responce_buf_len < sim868_responce_buf_len_max) &&
+		   (!sim868_command_length || (sim868_responce_buf_len < sim868_command_length)) &&
+		   sim868_rx_read( &sim868_responce_buf[ sim868_responce_buf_len ], 1, &sim868_command_line_count ) )
+	{
+		sim868_responce_buf_len++;
+		sim868_match_put( sim868_responce_buf[ sim868_responce_buf_len - 1 ] );
+		count++;
+	}
+	
+	if( count ) sim868_sleep_responce();
+	
+	return count;
+}
+
+//Data goes from the ring straight to its destination, without the responce buffer
+unsigned int sim868_rx_data_update( const sim868_command_t* command )
+{
+	unsigned int count;
+	
+	count = sim868_rx_read( &command->data[ sim868_command_data_len ], command->length - sim868_command_data_len, &sim868_command_line_count );
+	sim868_command_data_len += count;
+	
+	return count;
+}
+
+//Whole lines received outside of a command responce
+void sim868_unsolicited_update(void)
+{
+	unsigned char len;
+	
+	while( (len = sim868_rx_line_get( sim868_unsolicited_buf, SIM868_LINE_SIZE )) )
+	{
+		sim868_unsolicited_len = len;
+		sim868_urc_dispatch( sim868_unsolicited_buf, len );
+	}
+	
+	if( ((sim868_rx_head - sim868_rx_tail) & SIM868_RX_RING_MASK) == SIM868_RX_RING_MASK )
+	{
+		sim868_rx_read( 0, SIM868_RX_RING_SIZE, 0 );	//ring full of a line without end
+	}
+}
+
+unsigned char sim868_power_en(void)
+{
+	sim868_power_start();
+	
+	while( (sim868_power_state != SIM868_POWER_READY) && (sim868_power_state != SIM868_POWER_FAIL) )
+	{
+		sim868_update();
+		_delay_ms( SIM868_TIMEOUT_TICK );
+	}
+	
+	return ( sim868_power_state == SIM868_POWER_READY ) ? GOOD_CODE : ERROR_CODE;
+}
+
+//Non blocking power up, sim868_power_state_get() is SIM868_POWER_READY or SIM868_POWER_FAIL at the end
+void sim868_power_start(void)
+{
+	unsigned long first_request = sim868_power_stat.first_request;
+	
+	sim868_power_stat = (sim868_power_stat_t){ 0 };
+	sim868_power_stat.first_request = first_request;
+	sim868_power_start_tick = sim868_tick;
+	sim868_reg.status = SIM868_REG_NONE;
+	sim868_mux_state = SIM868_MUX_OFF;
+	sim868_sleep_state = SIM868_SLEEP_AWAKE;
+	sim868_sleep_tick = sim868_tick;
+	if( SIM868_SLEEP_MODE == 1 )
+	{
+		pin_output( SIM868_DTR_PIN );
+		pin_low( SIM868_DTR_PIN );
+	}
+	sim868_power_phase( SIM868_POWER_PROBE );
+}
+
+unsigned char sim868_power_state_get(void)
+{
+	return sim868_power_state;
+}
+
+const sim868_power_stat_t* sim868_power_stat_get(void)
+{
+	return &sim868_power_stat;
+}
+
+void sim868_power_update(void)
+{
+	unsigned long ticks = sim868_tick - sim868_power_tick;
+	unsigned char index = sim868_power_state - SIM868_POWER_ALIVE;
+	
+	switch( sim868_power_state )
+	{
+		case SIM868_POWER_PROBE:
+			if( sim868_power_stat.signals & SIM868_POWER_SIGNAL_AT ) sim868_power_ready();
+			else if( ticks >= SIM868_POWER_PROBE_TICK ) sim868_power_pulse();
+			else sim868_power_poke();
+		break;
+		
+		case SIM868_POWER_PULSE_HIGH:
+			if( ticks < SIM868_POWER_PULSE_TICK ) break;
+			pin_low( SIM868_EN_PIN );
+			sim868_power_phase( SIM868_POWER_PULSE_LOW );
+		break;
+		
+		case SIM868_POWER_PULSE_LOW:
+			if( ticks < SIM868_POWER_PULSE_TICK ) break;
+			pin_high( SIM868_EN_PIN );
+			sim868_power_stat.signals = 0;
+			sim868_power_phase( SIM868_POWER_ALIVE );
+		break;
+		
+		case SIM868_POWER_ALIVE:
+		case SIM868_POWER_CFUN:
+		case SIM868_POWER_CPIN:
+		case SIM868_POWER_CALL:
+		case SIM868_POWER_SMS:
+			if( !(sim868_power_stat.signals & pgm_read_byte( &sim868_power_phase_table[ index ].signals )) )
+			{
+				if( ticks < pgm_read_word( &sim868_power_phase_table[ index ].timeout ) )
+				{
+					if( sim868_power_state == SIM868_POWER_ALIVE ) sim868_power_poke();
+					break;
+				}
+				
+				if( sim868_power_state == SIM868_POWER_ALIVE )
+				{
+					if( sim868_power_stat.attempts < SIM868_POWER_ATTEMPTS ) sim868_power_pulse();
+					else sim868_power_phase( SIM868_POWER_FAIL );
+					break;
+				}
+				
+				sim868_power_stat.timeouts++;	//not every firmware sends all of them
+			}
+			
+			sim868_power_stat.phase[ index ] = ticks;
+			
+			if( sim868_power_state == SIM868_POWER_SMS ) sim868_power_ready();
+			else sim868_power_phase( sim868_power_state + 1 );
+		break;
+	}
+}
+
+void sim868_power_pulse(void)
+{
+	sim868_power_stat.attempts++;
+	
+	pin_output( SIM868_EN_PIN );
+	pin_high( SIM868_EN_PIN );
+	sim868_power_phase( SIM868_POWER_PULSE_HIGH );
+}
+
+void sim868_power_phase( unsigned char state )
+{
+	sim868_power_state = state;
+	sim868_power_tick = sim868_tick;
+}
+
+void sim868_power_ready(void)
+{
+	sim868_command_t commands[4] = { { 0 } };
+	
+	sim868_power_stat.boot = sim868_tick - sim868_power_start_tick;
+	sim868_power_phase( SIM868_POWER_READY );
+	
+	if( !sim868_power_stat.attempts ) sim868_session_state = sim868_warm_session;	//no pulse, bearer and HTTP are still open
+	sim868_warm_session = 0;
+	
+	sim868_command_load( &commands[0], SIM868_CMD_CREG_REPORT );
+	sim868_command_load( &commands[1], SIM868_CMD_CREG_QUERY );	//first state, later ones come as URCs
+	sim868_command_load( &commands[2], SIM868_CMD_GNSS_POWER_ON );
+	sim868_command_load( &commands[3], SIM868_CMD_GNSS_FILTER_RMC );
+	for( unsigned char i=0; i<4; i++ ) commands[i].lineout = 2;
+	commands[1].lineout = 4;
+	
+	if( sim868_batch_put( commands, 4, 0 ) )
+	{
+		for( unsigned char i=0; i<4; i++ ) sim868_command_put( &commands[i] );
+	}
+}
+
+//"AT" for autobaud, every SIM868_POWER_POKE_TICK at the next candidate rate until the module answers
+void sim868_power_poke(void)
+{
+	unsigned long baudrate;
+	
+	if( sim868_tick - sim868_power_poke_tick < SIM868_POWER_POKE_TICK ) return;
+	sim868_power_poke_tick = sim868_tick;
+	
+	do
+	{
+		sim868_power_rate = ( sim868_power_rate + 1 ) % ( SIM868_BAUDRATE_TABLE_SIZE + 1 );
+		baudrate = sim868_power_rate ? pgm_read_dword( &sim868_baudrate_table[ sim868_power_rate - 1 ] ) : SIM868_BAUDRATE;
+	} while( sim868_power_rate && ((baudrate > SIM868_BAUDRATE_MAX) || !sim868_baudrate_accurate( baudrate )) );
+	
+	if( baudrate != sim868_baudrate ) sim868_baudrate_set( baudrate );
+	
+	sim868_print_progmem( sim868_command__at );
+	sim868_print_newstr();
+}
+
+void sim868_power_unsolicited( unsigned char id, const char* line, unsigned char len )
+{
+	switch( id )
+	{
+		case SIM868_URC_ECHO:
+		case SIM868_URC_OK:
+			sim868_power_stat.signals |= SIM868_POWER_SIGNAL_AT;
+		break;
+		
+		case SIM868_URC_RDY:
+			sim868_power_stat.signals |= SIM868_POWER_SIGNAL_RDY;
+		break;
+		
+		case SIM868_URC_CFUN:
+			if( sim868_line_starts( line, len, sim868_urc__cfun_1 ) ) sim868_power_stat.signals |= SIM868_POWER_SIGNAL_CFUN;
+		break;
+		
+		case SIM868_URC_CPIN:
+			if( sim868_line_starts( line, len, sim868_urc__cpin_ready ) ) sim868_power_stat.signals |= SIM868_POWER_SIGNAL_CPIN;
+		break;
+		
+		case SIM868_URC_CALL_READY:
+			sim868_power_stat.signals |= SIM868_POWER_SIGNAL_CALL;
+		break;
+		
+		case SIM868_URC_SMS_READY:
+			sim868_power_stat.signals |= SIM868_POWER_SIGNAL_SMS;
+		break;
+		
+		case SIM868_URC_POWER_DOWN:
+			sim868_session_state = 0;
+			sim868_reg.status = SIM868_REG_NONE;
+			sim868_mux_state = SIM868_MUX_OFF;
+			sim868_power_phase( SIM868_POWER_OFF );
+		break;
+	}
+}
+
+
+
+void sim868_urc_callback_set( sim868_urc_callback_t callback )
+{
+	sim868_urc_callback = callback;
+}
+
+const sim868_urc_stat_t* sim868_urc_stat_get(void)
+{
+	return &sim868_urc_stat;
+}
+
+//Called for every line outside of a command and for URC lines inside of one
+void sim868_urc_dispatch( const char* line, unsigned char len )
+{
+	for( unsigned char i=0; i<SIM868_URC_TABLE_SIZE; i++ )
+	{
+		if( !sim868_line_starts( line, len, (const char*)pgm_read_word( &sim868_urc_table[i].text ) ) ) continue;
+		
+		unsigned char id = pgm_read_byte( &sim868_urc_table[i].id );
+		sim868_urc_callback_t handler = (sim868_urc_callback_t)pgm_read_word( &sim868_urc_table[i].handler );
+		
+		sim868_urc_stat.dispatched++;
+		if( handler ) handler( id, line, len );
+		if( sim868_urc_callback && (id > SIM868_URC_OK) ) sim868_urc_callback( id, line, len );
+		return;
+	}
+}
+
+//Bearer is lost, it is opened again by the next request
+void sim868_urc_network( unsigned char id, const char* line, unsigned char len )
+{
+	sim868_session_state = 0;
+	
+	if( (id == SIM868_URC_PDP_DEACT) && (sim868_socket_state == SIM868_SOCKET_OPEN) ) sim868_socket_state = SIM868_SOCKET_CLOSED;
+}
+
+const sim868_reg_t* sim868_reg_get(void)
+{
+	return &sim868_reg;
+}
+
+unsigned char sim868_reg_registered(void)
+{
+	return ( sim868_reg.status == SIM868_REG_HOME ) || ( sim868_reg.status == SIM868_REG_ROAMING );
+}
+
+//"+CREG: <stat>[,"<lac>","<ci>"]" as URC, "+CREG: <n>,<stat>[,"<lac>","<ci>"]" as the answer to AT+CREG?
+void sim868_reg_unsolicited( unsigned char id, const char* line, unsigned char len )
+{
+	unsigned int  field[4] = { 0 };
+	unsigned char count = 0;	//commas
+	unsigned char first;
+	
+	for( unsigned char i=sizeof(sim868_urc__creg)-1; (i<len) && (count<4); i++ )
+	{
+		char ch = line[i];
+		
+		if( ch == ',' ) count++;
+		else if( (ch >= '0') && (ch <= '9') ) field[ count ] = ( field[ count ] << 4 ) | ( ch - '0' );
+		else if( (ch >= 'A') && (ch <= 'F') ) field[ count ] = ( field[ count ] << 4 ) | ( ch - 'A' + 10 );
+		else if( (ch >= 'a') && (ch <= 'f') ) field[ count ] = ( field[ count ] << 4 ) | ( ch - 'a' + 10 );
+	}
+	if( count > 3 ) return;
+	
+	first = count & 1;	//odd number of commas, <n> leads
+	
+	if( field[ first ] != sim868_reg.status ) sim868_reg.changes++;
+	sim868_reg.status = field[ first ];
+	sim868_reg.tick = sim868_tick;
+	sim868_reg.reports++;
+	
+	if( count - first == 2 )
+	{
+		sim868_reg.lac = field[ first + 1 ];
+		sim868_reg.cell = field[ first + 2 ];
+	}
+}
+
+const sim868_signal_t* sim868_signal_get(void)
+{
+	return &sim868_signal;
+}
+
+const sim868_signal_stat_t* sim868_signal_stat_get(void)
+{
+	return &sim868_signal_stat;
+}
+
+//"+CSQ: <rssi>,<ber>"
+void sim868_signal_unsolicited( unsigned char id, const char* line, unsigned char len )
+{
+	unsigned char field[2] = { 0 };
+	unsigned char count = 0;	//commas
+	
+	for( unsigned char i=sizeof(sim868_urc__csq)-1; (i<len) && (count<2); i++ )
+	{
+		char ch = line[i];
+		
+		if( ch == ',' ) count++;
+		else if( (ch >= '0') && (ch <= '9') ) field[ count ] = field[ count ] * 10 + ( ch - '0' );
+	}
+	if( count != 1 ) return;
+	
+	sim868_signal.rssi = field[0];
+	sim868_signal.ber = field[1];
+	sim868_signal.tick = sim868_tick;
+	if( sim868_signal_good() ) sim868_signal_stat.good++;
+}
+
+//Last sample is fresh and over the thresholds
+unsigned char sim868_signal_good(void)
+{
+	if( !sim868_signal_stat.samples || (sim868_tick - sim868_signal.tick >= SIM868_SIGNAL_SAMPLE_TICK) ) return 0;
+	if( (sim868_signal.rssi == SIM868_SIGNAL_UNKNOWN) || (sim868_signal.rssi < SIM868_SIGNAL_RSSI_MIN) ) return 0;
+	
+	return ( sim868_signal.ber == SIM868_SIGNAL_UNKNOWN ) || ( sim868_signal.ber <= SIM868_SIGNAL_BER_MAX );
+}
+
+//Samples AT+CSQ every SIM868_SIGNAL_SAMPLE_TICK while a queued request is held for signal
+void sim868_signal_update(void)
+{
+	sim868_command_t command = { 0 };
+	unsigned char held = 0;
+	
+	if( (sim868_power_state != SIM868_POWER_READY) || sim868_recover_wait ) return;
+	
+	for( unsigned char i=0; i<sim868_request_queue_count; i++ )
+	{
+		sim868_request_t* request = &sim868_request_queue[i];
+		
+		if( sim868_request_ready( request ) ) continue;
+		held = 1;
+		if( request->deferred ) continue;
+		request->deferred = 1;
+		sim868_signal_stat.deferred++;
+	}
+	
+	if( !held || sim868_signal_sampling ) return;
+	if( sim868_signal_stat.samples && (sim868_tick - sim868_signal.tick < SIM868_SIGNAL_SAMPLE_TICK) ) return;
+	
+	sim868_command_load( &command, SIM868_CMD_CSQ );	//"+CSQ: " goes to sim868_signal_unsolicited()
+	command.lineout = 4;
+	command.callback = sim868_signal_sample_done;
+	if( sim868_command_put( &command ) ) return;
+	
+	sim868_signal_sampling = 1;
+	sim868_signal_stat.samples++;
+}
+
+void sim868_signal_sample_done( unsigned char code )
+{
+	sim868_signal_sampling = 0;
+	
+	if( code == GOOD_CODE ) return;
+	
+	sim868_signal.rssi = SIM868_SIGNAL_UNKNOWN;	//not asked again before the next period
+	sim868_signal.tick = sim868_tick;
+}
+
+const sim868_recover_stat_t* sim868_recover_stat_get(void)
+{
+	return &sim868_recover_stat;
+}
+
+void sim868_recover_update(void)
+{
+	if( !sim868_recover_wait ) return;
+	
+	switch( sim868_power_state )
+	{
+		case SIM868_POWER_READY:
+			if( !sim868_command_busy() ) sim868_recover_wait = 0;
+		break;
+		
+		case SIM868_POWER_OFF:
+			sim868_power_start();	//switched off by the power cycle pulse
+		break;
+		
+		case SIM868_POWER_FAIL:
+			sim868_recover_wait = 0;
+			sim868_recover_escalate();	//module did not come up, no request is needed to go on
+		break;
+	}
+}
+
+//Takes the next step after a failure, ERROR_CODE when the ladder is over and the request is given up
+unsigned char sim868_recover_escalate(void)
+{
+	sim868_command_t command = { 0 };
+	
+	sim868_recover_stat.failures++;
+	if( !sim868_recover_stat.step ) sim868_recover_tick = sim868_tick;
+	
+	if( sim868_recover_stat.step >= SIM868_RECOVER_WATCHDOG )
+	{
+		sim868_recover_stat.step = SIM868_RECOVER_NONE;	//starts over with the next failure
+		return ERROR_CODE;
+	}
+	
+	switch( ++sim868_recover_stat.step )
+	{
+		case SIM868_RECOVER_SESSION:
+			sim868_session_close_put();
+		break;
+		
+		case SIM868_RECOVER_CFUN:
+			sim868_session_close_put();
+			sim868_command_load( &command, SIM868_CMD_CFUN_RESET );
+			command.lineout = 2;
+			command.callback = sim868_recover_cfun_done;
+			sim868_command_put( &command );
+			sim868_recover_wait = 1;
+		break;
+		
+		case SIM868_RECOVER_POWER:
+			sim868_session_state = 0;
+			sim868_power_start();
+			sim868_power_pulse();
+			sim868_recover_wait = 1;
+		break;
+		
+		case SIM868_RECOVER_WATCHDOG:
+			sim868_recover_restart();
+		break;
+	}
+	
+	return GOOD_CODE;
+}
+
+void sim868_recover_end(void)
+{
+	unsigned char index = sim868_recover_stat.step - 1;
+	
+	if( !sim868_recover_stat.step ) return;
+	
+	sim868_recover_stat.ticks[ index ] = sim868_tick - sim868_recover_tick;
+	sim868_recover_stat.count[ index ]++;
+	sim868_recover_stat.step = SIM868_RECOVER_NONE;
+}
+
+//Module restarts after OK, the power up sequence is followed from SIM868_POWER_ALIVE
+void sim868_recover_cfun_done( unsigned char code )
+{
+	sim868_session_state = 0;
+	sim868_power_start();
+	sim868_power_phase( SIM868_POWER_ALIVE );
+}
+
+void sim868_recover_restart(void)
+{
+	sim868_warm_save();
+	sim868_tx_flush();
+	
+	interrupts_global_dis();
+	wdt_enable( WDTO_15MS );
+	while( 1 );
+}
+
+//Saved when something worth keeping changes, so any watchdog reset finds it
+void sim868_warm_update(void)
+{
+	if( (sim868_warm.session_state == sim868_session_state) &&
+		(sim868_warm.session_url_crc == sim868_session_url_crc) &&
+		(sim868_warm.session_content == sim868_session_content) &&
+		(sim868_warm.power_state == sim868_power_state) &&
+		(sim868_warm.baudrate == sim868_baudrate) &&
+		(sim868_warm.recover.step == sim868_recover_stat.step) ) return;
+	
+	sim868_warm_save();
+}
+
+void sim868_warm_save(void)
+{
+	sim868_warm.baudrate = sim868_baudrate;
+	sim868_warm.recover_ticks = sim868_recover_stat.step ? sim868_tick - sim868_recover_tick : 0;
+	sim868_warm.recover = sim868_recover_stat;
+	sim868_warm.session_url_crc = sim868_session_url_crc;
+	sim868_warm.session_content = sim868_session_content;
+	sim868_warm.session_state = sim868_session_state;
+	sim868_warm.power_state = sim868_power_state;
+	sim868_warm.magic = SIM868_WARM_MAGIC;
+	sim868_warm.crc = sim868_crc16_block( 0xFFFF, &sim868_warm, offsetof( sim868_warm_t, crc ) );
+}
+
+//GOOD_CODE after a warm restart, the module is first probed at the rate it was left at
+unsigned char sim868_warm_restore(void)
+{
+	if( sim868_warm.magic != SIM868_WARM_MAGIC ) return ERROR_CODE;
+	if( sim868_warm.crc != sim868_crc16_block( 0xFFFF, &sim868_warm, offsetof( sim868_warm_t, crc ) ) ) return ERROR_CODE;
+	
+	//the reset was the last step, the ladder starts over with the next failure
+	sim868_recover_stat = sim868_warm.recover;
+	sim868_recover_stat.restarts++;
+	if( sim868_recover_stat.step == SIM868_RECOVER_WATCHDOG )
+	{
+		sim868_recover_stat.ticks[ SIM868_RECOVER_WATCHDOG - 1 ] = sim868_warm.recover_ticks;
+		sim868_recover_stat.count[ SIM868_RECOVER_WATCHDOG - 1 ]++;
+	}
+	sim868_recover_stat.step = SIM868_RECOVER_NONE;
+	
+	if( sim868_warm.power_state == SIM868_POWER_READY )
+	{
+		sim868_warm_session = sim868_warm.session_state;
+		sim868_session_url_crc = sim868_warm.session_url_crc;
+		sim868_session_content = sim868_warm.session_content;
+	}
+	
+	//sim868_power_poke() takes the rate after sim868_power_rate
+	for( unsigned char i=0; i<SIM868_BAUDRATE_TABLE_SIZE; i++ )
+	{
+		if( pgm_read_dword( &sim868_baudrate_table[i] ) != sim868_warm.baudrate ) continue;
+		sim868_baudrate = sim868_warm.baudrate;
+		sim868_power_rate = i;
+	}
+	
+	return GOOD_CODE;
+}
+
+//Clears the watchdog left enabled by sim868_recover_restart() before it fires again during startup,
+//the reset cause is kept for sim868_reset_cause_get() as MCUSR has to be cleared for that
+void sim868_wdt_init(void) __attribute__(( naked, used, section(".init3") ));
+void sim868_wdt_init(void)
+{
+	sim868_reset_cause = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+}
+
+unsigned char sim868_reset_cause_get(void)
+{
+	return sim868_reset_cause;
+}
+
+void sim868_retry_policy_set( unsigned char id, const sim868_retry_policy_t* policy )
+{
+	sim868_retry_policy[ id ] = *policy;
+}
+
+const sim868_retry_stat_t* sim868_retry_stat_get( unsigned char id )
+{
+	return &sim868_retry_stat[ id ];
+}
+
+//First attempt of an operation
+void sim868_retry_begin( unsigned char id )
+{
+	sim868_retry[ id ].begin = sim868_tick;
+	sim868_retry[ id ].attempt = 1;
+	sim868_retry_stat[ id ].attempts++;
+}
+
+//Ticks to wait before the next attempt, 0 when the operation is given up
+unsigned int sim868_retry_next( unsigned char id )
+{
+	const sim868_retry_policy_t* policy = &sim868_retry_policy[ id ];
+	sim868_retry_t* retry = &sim868_retry[ id ];
+	unsigned long backoff = policy->base;
+	
+	if( !retry->attempt ) return 0;
+	
+	for( unsigned char i=1; (i<retry->attempt) && (backoff < policy->max); i++ ) backoff <<= 1;
+	if( backoff > policy->max ) backoff = policy->max;
+	backoff -= sim868_retry_rand() % ( backoff / 2 + 1 );	//attempts of many devices do not meet again
+	if( !backoff ) backoff = 1;
+	
+	if( retry->attempt >= policy->attempts )
+	{
+		retry->attempt = 0;
+		sim868_retry_stat[ id ].failures++;
+		return 0;
+	}
+	
+	if( policy->deadline && (sim868_tick - retry->begin + backoff > policy->deadline) )
+	{
+		retry->attempt = 0;
+		sim868_retry_stat[ id ].failures++;
+		sim868_retry_stat[ id ].deadlines++;
+		return 0;
+	}
+	
+	retry->attempt++;
+	sim868_retry_stat[ id ].attempts++;
+	sim868_retry_stat[ id ].backoff += backoff;
+	
+	return backoff;
+}
+
+void sim868_retry_done( unsigned char id )
+{
+	if( !sim868_retry[ id ].attempt ) return;
+	
+	sim868_retry[ id ].attempt = 0;
+	sim868_retry_stat[ id ].successes++;
+}
+
+unsigned int sim868_retry_rand(void)
+{
+	sim868_retry_seed = sim868_retry_seed * 25173 + 13849 + (unsigned int)sim868_tick;
+	
+	return sim868_retry_seed;
+}
+
+unsigned char sim868_sleep_state_get(void)
+{
+	return sim868_sleep_state;
+}
+
+const sim868_sleep_stat_t* sim868_sleep_stat_get(void)
+{
+	return &sim868_sleep_stat;
+}
+
+//Puts the module to sleep once nothing has used it for SIM868_SLEEP_IDLE_TICK
+void sim868_sleep_update(void)
+{
+	sim868_command_t command = { 0 };
+	
+	if( !SIM868_SLEEP_MODE || (sim868_sleep_state != SIM868_SLEEP_AWAKE) ) return;
+	
+	if( sim868_command_queue_count || sim868_request_due() || sim868_nmea_enabled ||
+		(sim868_power_state != SIM868_POWER_READY) ||
+		(sim868_mux_state != SIM868_MUX_OFF) ||
+		(sim868_socket_state != SIM868_SOCKET_CLOSED) )
+	{
+		sim868_sleep_tick = sim868_tick;
+		return;
+	}
+	
+	if( sim868_tick - sim868_sleep_tick < SIM868_SLEEP_IDLE_TICK ) return;
+	
+	//Sent on each entry, a CFUN reset or a power cycle sets CSCLK back to 0
+	sim868_command_load( &command, (SIM868_SLEEP_MODE == 1) ? SIM868_CMD_CSCLK_DTR : SIM868_CMD_CSCLK_AUTO );
+	command.callback = sim868_sleep_enter_done;
+	if( sim868_command_put( &command ) ) return;
+	
+	sim868_sleep_state = SIM868_SLEEP_ENTER;
+}
+
+void sim868_sleep_enter_done( unsigned char code )
+{
+	sim868_sleep_tick = sim868_tick;
+	
+	if( code )
+	{
+		sim868_sleep_state = SIM868_SLEEP_AWAKE;	//next try after another idle period
+		return;
+	}
+	
+	if( SIM868_SLEEP_MODE == 1 ) pin_high( SIM868_DTR_PIN );
+	
+	sim868_sleep_state = SIM868_SLEEP_ASLEEP;
+	sim868_sleep_stat.sleeps++;
+}
+
+//Called before each command is sent, the command then waits for sim868_sleep_guard()
+void sim868_sleep_wake(void)
+{
+	if( sim868_sleep_state != SIM868_SLEEP_ASLEEP ) return;
+	
+	if( SIM868_SLEEP_MODE == 1 ) pin_low( SIM868_DTR_PIN );
+	else sim868_tx_char( '\r' );	//lost while the UART sleeps, an empty line otherwise
+	
+	sim868_sleep_stat.asleep += sim868_tick - sim868_sleep_tick;
+	sim868_sleep_stat.wakes++;
+	sim868_sleep_wake_tick = sim868_tick;
+	sim868_sleep_state = SIM868_SLEEP_WAKE;
+}
+
+//ERROR_CODE while the module is still waking up
+unsigned char sim868_sleep_guard(void)
+{
+	if( sim868_sleep_state != SIM868_SLEEP_WAKE ) return GOOD_CODE;
+	if( sim868_tick - sim868_sleep_wake_tick < SIM868_SLEEP_WAKE_TICK ) return ERROR_CODE;
+	
+	sim868_sleep_state = SIM868_SLEEP_AWAKE;
+	sim868_sleep_latency_wait = 1;
+	
+	return GOOD_CODE;
+}
+
+//Wake to first responce byte latency
+void sim868_sleep_responce(void)
+{
+	unsigned int latency;
+	
+	if( !sim868_sleep_latency_wait ) return;
+	
+	sim868_sleep_latency_wait = 0;
+	latency = sim868_tick - sim868_sleep_wake_tick;
+	sim868_sleep_stat.latency += latency;
+	sim868_sleep_stat.latency_last = latency;
+	if( latency > sim868_sleep_stat.latency_max ) sim868_sleep_stat.latency_max = latency;
+}
+
+void sim868_power_dis(void)
+{
+	if( sim868_sleep_state == SIM868_SLEEP_ASLEEP )
+	{
+		sim868_sleep_wake();
+		_delay_ms( SIM868_SLEEP_WAKE_TICK * SIM868_TIMEOUT_TICK );
+	}
+	
+	sim868_print_progmem_by_len( sim868_command_line( SIM868_CMD_POWER_DOWN ), sim868_command_line_len( SIM868_CMD_POWER_DOWN ) );
+	sim868_print_newstr();
+	_delay_ms(1000);
+	
+	sim868_power_phase( SIM868_POWER_OFF );
+}
+
+void sim868_delay(unsigned int delay_time)
+{
+	//_delay_ms( delay_time );
+	unsigned int i;
+	unsigned int j = delay_time;
+	
+	while(j--)
+	{
+		i = SIM868_DELAY_TICK_MS; 
+		while(i--) asm("NOP");
+	}
+}
+
+void sim868_buffer_print(char *buffer, unsigned int start_point, unsigned int end_point)
+{
+	for( unsigned int i=start_point; i<end_point; i++ )
+	{
+		sim868_print_char( buffer[i] );
+	}
+}
+
+
+
+
+
+//Call every SIM868_TIMEOUT_TICK ms, commands queued by sim868_command_put() run from here
+void sim868_update(void)
+{
+	sim868_tick++;
+	sim868_power_update();
+	sim868_signal_update();
+	sim868_sleep_update();
+	sim868_recover_update();
+	sim868_mux_update();
+	sim868_command_update();
+	sim868_request_update();
+	sim868_session_update();
+	sim868_track_update();
+	sim868_outbox_update();
+	sim868_warm_update();
+}
+
+
+
+#ifdef SIM868_TX_QUEUE
+ISR (usart_empty_interrupt_vector)
+{
+	volatile sim868_tx_segment_t* segment = &sim868_tx_segment[ sim868_tx_segment_tail ];
+	
+	if( sim868_tx_segment_tail == sim868_tx_segment_head )
+	{
+		usart_empty_intr_dis();
+		return;
+	}
+	
+	if( segment->data )
+	{
+		usart_transmite_byte_put( (char)pgm_read_byte( segment->data ) );
+		segment->data++;
+	}
+	else
+	{
+		usart_transmite_byte_put( sim868_tx_ring[ sim868_tx_tail ] );
+		sim868_tx_tail = ( sim868_tx_tail + 1 ) & SIM868_TX_RING_MASK;
+	}
+	
+	if( !--segment->len ) sim868_tx_segment_tail = ( sim868_tx_segment_tail + 1 ) & SIM868_TX_SEGMENT_MASK;
+}
+#endif
+
+ISR (usart_interrupt_vector)
+{
+	usart_received_byte_get( sim868_readed_char );
+	
+	if( sim868_mux_state ) sim868_mux_rx_put( sim868_readed_char );
+	else sim868_rx_put( sim868_readed_char );
+}
+
+//Received byte without the multiplexer, NMEA sentences are taken out of the stream between raw data
+void sim868_rx_put( char data )
+{
+	if( !sim868_rx_binary && (sim868_socket_state != SIM868_SOCKET_TRANSPARENT) && sim868_nmea_divert( data ) ) return;
+	sim868_rx_ring_put( data );
+}
+
+//Returns 1 if the byte belongs to a NMEA sentence, tracks line starts otherwise
+unsigned char sim868_nmea_divert( char data )
+{
+	if( sim868_nmea_state & SIM868_NMEA_STATE_SENTENCE )
+	{
+		sim868_nmea_put( data );
+		return 1;
+	}
+	if( sim868_nmea_enabled && (sim868_nmea_state & SIM868_NMEA_STATE_LINE_START) && (data == '$') )
+	{
+		sim868_nmea_begin();
+		return 1;
+	}
+	if( data == '\n' ) sim868_nmea_state = SIM868_NMEA_STATE_LINE_START;
+	else sim868_nmea_state = 0;
+	
+	return 0;
+}
+
+void sim868_rx_ring_put( char data )
+{
+	unsigned char head = sim868_rx_head;
+	unsigned char next = (head + 1) & SIM868_RX_RING_MASK;
+	
+	if( next == sim868_rx_tail )
+	{
+		sim868_rx_overflow++;
+		return;
+	}
+	
+	sim868_rx_ring[ head ] = data;
+	
+	if( data == '\n' )
+	{
+		unsigned char line_next = (sim868_rx_line_head + 1) & SIM868_RX_LINE_RING_MASK;
+		
+		if( line_next != sim868_rx_line_tail )
+		{
+			sim868_rx_line_ring[ sim868_rx_line_head ] = head;
+			sim868_rx_line_head = line_next;
+		}
+		else
+		{
+			sim868_rx_overflow++;
+		}
+	}
+	
+	sim868_rx_head = next;
+}
+
+
+
+unsigned char sim868_mux_state_get(void)
+{
+	return sim868_mux_state;
+}
+
+const sim868_mux_stat_t* sim868_mux_stat_get( unsigned char channel )
+{
+	if( channel >= SIM868_MUX_CHANNELS ) return 0;
+	return &sim868_mux_stat[ channel ];
+}
+
+//AT+CMUX=0, then SABM to the control channel and to each channel, NMEA output is moved
+//to its own channel so fixes keep coming during HTTP and socket transfers. Every step waits
+//at most SIM868_MUX_OPEN_TICK, NMEA stays off if CGNSTST is not answered with OK
+unsigned char sim868_mux_en(void)
+{
+	sim868_command_t command = { 0 };
+	sim868_command_load( &command, SIM868_CMD_CMUX );
+	command.lineout = 2;
+	
+	if( sim868_mux_state != SIM868_MUX_OFF ) return ERROR_CODE;
+	if( sim868_command_wait( &command ) ) return ERROR_CODE;
+	
+	sim868_tx_flush();
+	for( unsigned char i=0; i<SIM868_MUX_CHANNELS; i++ ) sim868_mux_stat[i] = (sim868_mux_stat_t){ 0 };
+	sim868_mux_rx_state = SIM868_MUX_RX_FLAG;
+	sim868_mux_flow = 0;
+	sim868_mux_reply = 0;
+	sim868_mux_tx_reset();
+	for( unsigned char i=0; i<2; i++ ) sim868_mux_ring_head[i] = sim868_mux_ring_tail[i] = 0;
+	sim868_mux_state = SIM868_MUX_STARTING;
+	
+	for( unsigned char dlci=0; dlci<SIM868_MUX_CHANNELS; dlci++ )
+	{
+		if( sim868_mux_open( dlci ) )
+		{
+			sim868_mux_dis();
+			return ERROR_CODE;
+		}
+	}
+	sim868_mux_state = SIM868_MUX_ON;
+	
+	sim868_nmea_state = SIM868_NMEA_STATE_LINE_START;
+	sim868_nmea_enabled = 1;	//sentences right after OK are taken out of the channel
+	if( sim868_mux_progmem_write( SIM868_MUX_NMEA, sim868_command_line( SIM868_CMD_GNSS_NMEA_ON ) ) ||
+		sim868_mux_char( SIM868_MUX_NMEA, '\n' ) ||
+		sim868_mux_nmea_reply() )
+	{
+		sim868_nmea_enabled = 0;
+	}
+	
+	return GOOD_CODE;
+}
+
+//Close down, the module goes back to plain AT commands
+void sim868_mux_dis(void)
+{
+	const unsigned char cld[2] = { SIM868_MUX_CLD_COMMAND, SIM868_MUX_EA };
+	
+	if( sim868_mux_state == SIM868_MUX_OFF ) return;
+	
+	sim868_mux_flush();
+	sim868_mux_frame_print( SIM868_MUX_CONTROL, SIM868_MUX_UIH, cld, sizeof(cld) );
+	sim868_tx_flush();
+	
+	sim868_mux_state = SIM868_MUX_OFF;
+	sim868_mux_tx_reset();		//frames still held by flow control are lost
+	sim868_nmea_enabled = 0;
+	sim868_nmea_state = SIM868_NMEA_STATE_LINE_START;
+	for( unsigned char i=0; i<SIM868_MUX_CHANNELS; i++ ) sim868_mux_stat[i].open = 0;
+}
+
+unsigned char sim868_mux_open( unsigned char dlci )
+{
+	const unsigned char msc[4] = { SIM868_MUX_MSC_COMMAND, (2 << 1) | SIM868_MUX_EA, (dlci << 2) | SIM868_MUX_CR | SIM868_MUX_EA, SIM868_MUX_V24 };
+	
+	sim868_mux_ack = 0;
+	sim868_mux_ack_dlci = dlci;
+	sim868_mux_frame_print( dlci, SIM868_MUX_SABM | SIM868_MUX_PF, 0, 0 );
+	
+	for( unsigned int i=0; (i < SIM868_MUX_OPEN_TICK) && !sim868_mux_ack; i++ )
+	{
+		sim868_update();
 		_delay_ms( SIM868_TIMEOUT_TICK );
 	}
+	if( (sim868_mux_ack & ~SIM868_MUX_PF) != SIM868_MUX_UA ) return ERROR_CODE;
 	
+	sim868_mux_stat[ dlci ].open = 1;
+	if( dlci ) sim868_mux_frame_print( SIM868_MUX_CONTROL, SIM868_MUX_UIH, msc, sizeof(msc) );	//ready to receive
 	
-	sim868_responce_pointer = 0;
-	unsigned char char_a;
-	unsigned char char_b;
+	return GOOD_CODE;
+}
+
+//Answer to AT+CGNSTST=1 on the NMEA channel, the echo and empty lines are skipped
+unsigned char sim868_mux_nmea_reply(void)
+{
+	char head[2] = { 0 };
+	unsigned char len = 0;
+	char data;
 	
-	for( unsigned int i=0; i<sim868_responce_buf_len; i++)
+	for( unsigned int i=0; i<SIM868_MUX_OPEN_TICK; i++ )
 	{
-		char_a = sim868_responce_buf[i];
-		char_b = pgm_read_byte( &sim868_responce[ sim868_responce_pointer ] );
-		if( char_a == char_b )
+		while( sim868_mux_read( SIM868_MUX_NMEA, &data, 1 ) )
 		{
-			sim868_responce_pointer++;
-			if( sim868_responce_pointer >= sim868_responce_len )
+			if( data == '\r' ) continue;
+			if( data != '\n' )
 			{
-				sim868_responce_write_pointer_begin = i;
-				sim868_responce_write_pointer_end = sim868_responce_write_pointer_begin;
-				return GOOD_CODE;
+				if( len < sizeof(head) ) head[ len ] = data;
+				if( len < 255 ) len++;
+				continue;
 			}
+			
+			if( (len == 2) && (head[0] == 'O') && (head[1] == 'K') ) return GOOD_CODE;
+			if( len && !((head[0] == 'A') && (head[1] == 'T')) ) return ERROR_CODE;
+			len = 0;
 		}
-		else
-		{
-			sim868_responce_pointer = 0;			
-		}
+		
+		sim868_update();
+		_delay_ms( SIM868_TIMEOUT_TICK );
 	}
 	
 	return ERROR_CODE;
 }
 
-void sim868_power_en(void)
+//Written in frames of up to SIM868_MUX_FRAME_SIZE, returns bytes taken, fewer when
+//flow control holds SIM868_MUX_TX_FRAMES frames
+unsigned int sim868_mux_write( unsigned char channel, const char* data, unsigned int len )
 {
-	_delay_ms(1000);
+	unsigned int count = 0;
 	
-	if( (sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) ||
-		(sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) ||
-		(sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) ||
-		(sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) ) 
-	{		
-		sim868_command_responce( sim868_command__gnss_power_on, sim868_data__ok );
-		sim868_command_responce( sim868_command__gnss_filter_rmc, sim868_data__ok );
-		
-		return;
-	}
+	if( (sim868_mux_state != SIM868_MUX_ON) || (channel <= SIM868_MUX_AT) || (channel >= SIM868_MUX_CHANNELS) ) return 0;
 	
-	pin_output( SIM868_EN_PIN );
+	while( (count < len) && !sim868_mux_char( channel, data[ count ] ) ) count++;
+	sim868_mux_flush();
 	
-	pin_high( SIM868_EN_PIN );
-	_delay_ms(1000);
-	pin_low( SIM868_EN_PIN );
-	_delay_ms(1000);
-	pin_high( SIM868_EN_PIN );
-	_delay_ms(5000);
+	return count;
+}
+
+unsigned int sim868_mux_read( unsigned char channel, char* data, unsigned int size )
+{
+	unsigned int count = 0;
 	
-	sim868_print_progmem( sim868_command__at );
-	sim868_print_newstr();
-	_delay_ms(5000);
+	if( (channel <= SIM868_MUX_AT) || (channel >= SIM868_MUX_CHANNELS) ) return 0;
+	channel -= SIM868_MUX_NMEA;
 	
-	sim868_print_progmem( sim868_command__at );
-	sim868_print_newstr();
-	_delay_ms(3000);
+	while( (count < size) && (sim868_mux_ring_tail[ channel ] != sim868_mux_ring_head[ channel ]) )
+	{
+		data[ count++ ] = sim868_mux_ring[ channel ][ sim868_mux_ring_tail[ channel ] ];
+		sim868_mux_ring_tail[ channel ] = ( sim868_mux_ring_tail[ channel ] + 1 ) & SIM868_MUX_RING_MASK;
+	}
 	
+	return count;
+}
+
+unsigned char sim868_mux_progmem_write( unsigned char channel, const char* data )
+{
+	for( unsigned int i=0; (char)pgm_read_byte( &data[i] ); i++ )
+	{
+		if( sim868_mux_char( channel, (char)pgm_read_byte( &data[i] ) ) ) return ERROR_CODE;
+	}
 	
-	sim868_command_responce( sim868_command__at, sim868_data__error );
-	sim868_command_responce( sim868_command__gnss_power_on, sim868_data__ok );
-	sim868_command_responce( sim868_command__gnss_filter_rmc, sim868_data__ok );
-	_delay_ms(100);
+	return GOOD_CODE;
+}
+
+//Frames end at a line end, when full or when another channel is written. Nothing waits for
+//flow control here, ERROR_CODE when SIM868_MUX_TX_FRAMES frames are held and the byte is not taken
+unsigned char sim868_mux_char( unsigned char channel, char data )
+{
+	unsigned char fill = ( sim868_mux_tx_first + sim868_mux_tx_held ) % SIM868_MUX_TX_FRAMES;
 	
-	if( (sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) ||
-	(sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) ||
-	(sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) ||
-	(sim868_command_responce(sim868_command__at, sim868_data__error) == GOOD_CODE) )
+	if( (sim868_mux_tx_held < SIM868_MUX_TX_FRAMES) && sim868_mux_tx_len[ fill ] &&
+		((channel != sim868_mux_tx_channel[ fill ]) || (sim868_mux_tx_len[ fill ] >= SIM868_MUX_FRAME_SIZE)) )
 	{
-		sim868_command_responce( sim868_command__gnss_power_on, sim868_data__ok );
-		sim868_command_responce( sim868_command__gnss_filter_rmc, sim868_data__ok );
-		
-		return;
+		sim868_mux_flush();
+		fill = ( sim868_mux_tx_first + sim868_mux_tx_held ) % SIM868_MUX_TX_FRAMES;
+	}
+	if( sim868_mux_tx_held >= SIM868_MUX_TX_FRAMES )
+	{
+		sim868_mux_stat[ channel ].refused++;
+		return ERROR_CODE;
 	}
 	
-	pin_output( SIM868_EN_PIN );
-	
-	pin_high( SIM868_EN_PIN );
-	_delay_ms(1000);
-	pin_low( SIM868_EN_PIN );
-	_delay_ms(1000);
-	pin_high( SIM868_EN_PIN );
-	_delay_ms(5000);
+	sim868_mux_tx_channel[ fill ] = channel;
+	sim868_mux_tx_buf[ fill ][ sim868_mux_tx_len[ fill ]++ ] = data;
 	
-	sim868_print_progmem( sim868_command__at );
-	sim868_print_newstr();
-	_delay_ms(5000);
+	if( data == '\n' ) sim868_mux_flush();
 	
-	sim868_print_progmem( sim868_command__at );
-	sim868_print_newstr();
-	_delay_ms(500);
+	return GOOD_CODE;
+}
+
+//Closes the frame being filled, then sends held frames in order up to the first one whose
+//channel is stopped by flow control, the rest go out from sim868_mux_update()
+void sim868_mux_flush(void)
+{
+	unsigned char index = ( sim868_mux_tx_first + sim868_mux_tx_held ) % SIM868_MUX_TX_FRAMES;
+	unsigned char channel;
 	
-	sim868_command_responce( sim868_command__at, sim868_data__error );
-	sim868_command_responce( sim868_command__gnss_power_on, sim868_data__ok );
-	sim868_command_responce( sim868_command__gnss_filter_rmc, sim868_data__ok );
-	_delay_ms(100);
+	if( (sim868_mux_tx_held < SIM868_MUX_TX_FRAMES) && sim868_mux_tx_len[ index ] )
+	{
+		channel = sim868_mux_tx_channel[ index ];
+		if( sim868_mux_tx_held || (sim868_mux_flow & (SIM868_MUX_FLOW_ALL | (1 << channel))) ) sim868_mux_stat[ channel ].blocked++;
+		sim868_mux_tx_held++;
+	}
 	
+	while( sim868_mux_tx_held )
+	{
+		index = sim868_mux_tx_first;
+		channel = sim868_mux_tx_channel[ index ];
+		if( sim868_mux_flow & (SIM868_MUX_FLOW_ALL | (1 << channel)) ) return;
+		
+		sim868_mux_frame_print( channel, SIM868_MUX_UIH, (const unsigned char*)sim868_mux_tx_buf[ index ], sim868_mux_tx_len[ index ] );
+		sim868_mux_stat[ channel ].tx_frames++;
+		sim868_mux_stat[ channel ].tx_bytes += sim868_mux_tx_len[ index ];
+		sim868_mux_tx_len[ index ] = 0;
+		sim868_mux_tx_first = ( index + 1 ) % SIM868_MUX_TX_FRAMES;
+		sim868_mux_tx_held--;
+	}
 }
 
-void sim868_power_dis(void)
+void sim868_mux_tx_reset(void)
 {
-	sim868_print_progmem( sim868_data__at_plus );
-	sim868_print_progmem( sim868_command__power_down );
-	sim868_print_progmem( sim868_data__en );
-	sim868_print_newstr();
-	_delay_ms(1000);
+	for( unsigned char i=0; i<SIM868_MUX_TX_FRAMES; i++ ) sim868_mux_tx_len[i] = 0;
+	sim868_mux_tx_first = 0;
+	sim868_mux_tx_held = 0;
 }
 
-void sim868_delay(unsigned int delay_time)
+void sim868_mux_frame_print( unsigned char dlci, unsigned char control, const unsigned char* data, unsigned char len )
 {
-	//_delay_ms( delay_time );
-	unsigned int i;
-	unsigned int j = delay_time;
+	unsigned char header[3] = { (dlci << 2) | SIM868_MUX_CR | SIM868_MUX_EA, control, (len << 1) | SIM868_MUX_EA };
+	unsigned char fcs = 0xFF;
 	
-	while(j--)
+	sim868_tx_char( SIM868_MUX_FLAG );
+	for( unsigned char i=0; i<sizeof(header); i++ )
 	{
-		i = SIM868_DELAY_TICK_MS; 
-		while(i--) asm("NOP");
+		fcs = sim868_mux_crc( fcs, header[i] );
+		sim868_tx_char( header[i] );
 	}
+	for( unsigned char i=0; i<len; i++ ) sim868_tx_char( data[i] );
+	sim868_tx_char( 0xFF - fcs );
+	sim868_tx_char( SIM868_MUX_FLAG );
 }
 
-void sim868_buffer_print(char *buffer, unsigned int start_point, unsigned int end_point)
+//Responces to control channel commands and frames held by flow control, every tick
+void sim868_mux_update(void)
 {
-	for( unsigned int i=start_point; i<end_point; i++ )
+	unsigned char reply;
+	
+	if( sim868_mux_state == SIM868_MUX_OFF ) return;
+	
+	interrupts_global_dis();
+	reply = sim868_mux_reply;
+	sim868_mux_reply = 0;
+	interrupts_global_en();
+	
+	if( reply & SIM868_MUX_REPLY_MSC )
 	{
-		sim868_print_char( buffer[i] );
+		const unsigned char msc[4] = { SIM868_MUX_MSC_RESPONCE, (2 << 1) | SIM868_MUX_EA, sim868_mux_msc_address, sim868_mux_msc_signals };
+		sim868_mux_frame_print( SIM868_MUX_CONTROL, SIM868_MUX_UIH, msc, sizeof(msc) );
+	}
+	if( reply & SIM868_MUX_REPLY_FCON )
+	{
+		const unsigned char fcon[2] = { SIM868_MUX_FCON_RESPONCE, SIM868_MUX_EA };
+		sim868_mux_frame_print( SIM868_MUX_CONTROL, SIM868_MUX_UIH, fcon, sizeof(fcon) );
 	}
+	if( reply & SIM868_MUX_REPLY_FCOFF )
+	{
+		const unsigned char fcoff[2] = { SIM868_MUX_FCOFF_RESPONCE, SIM868_MUX_EA };
+		sim868_mux_frame_print( SIM868_MUX_CONTROL, SIM868_MUX_UIH, fcoff, sizeof(fcoff) );
+	}
+	
+	sim868_mux_flush();
 }
 
+//CRC-8 of 07.10, reversed polynomial x^8 + x^2 + x + 1
+unsigned char sim868_mux_crc( unsigned char crc, unsigned char data )
+{
+	crc ^= data;
+	for( unsigned char i=0; i<8; i++ ) crc = ( crc & 0x01 ) ? ( (crc >> 1) ^ 0xE0 ) : ( crc >> 1 );
+	
+	return crc;
+}
 
-
-
-
-void sim868_update(void)
+//Deframer, called from the ISR; information is kept until the FCS is checked
+void sim868_mux_rx_put( unsigned char data )
 {
-	_delay_ms(3000);
+	switch( sim868_mux_rx_state )
+	{
+		case SIM868_MUX_RX_FLAG:
+			if( data == SIM868_MUX_FLAG ) sim868_mux_rx_state = SIM868_MUX_RX_ADDRESS;
+		break;
+		
+		case SIM868_MUX_RX_ADDRESS:
+			if( data == SIM868_MUX_FLAG ) break;	//closing and opening flags
+			sim868_mux_rx_address = data;
+			sim868_mux_rx_fcs = sim868_mux_crc( 0xFF, data );
+			sim868_mux_rx_state = SIM868_MUX_RX_CONTROL;
+		break;
+		
+		case SIM868_MUX_RX_CONTROL:
+			sim868_mux_rx_control = data;
+			sim868_mux_rx_fcs = sim868_mux_crc( sim868_mux_rx_fcs, data );
+			sim868_mux_rx_state = SIM868_MUX_RX_LENGTH;
+		break;
+		
+		case SIM868_MUX_RX_LENGTH:
+			sim868_mux_rx_fcs = sim868_mux_crc( sim868_mux_rx_fcs, data );
+			sim868_mux_rx_len = data >> 1;
+			sim868_mux_rx_index = 0;
+			if( !(data & SIM868_MUX_EA) || (sim868_mux_rx_len > SIM868_MUX_FRAME_SIZE) )
+			{
+				sim868_mux_stat[ SIM868_MUX_CONTROL ].errors++;	//longer than N1
+				sim868_mux_rx_state = SIM868_MUX_RX_FLAG;
+				break;
+			}
+			sim868_mux_rx_state = sim868_mux_rx_len ? SIM868_MUX_RX_DATA : SIM868_MUX_RX_FCS;
+		break;
+		
+		case SIM868_MUX_RX_DATA:
+			sim868_mux_rx_buf[ sim868_mux_rx_index++ ] = data;
+			if( sim868_mux_rx_index >= sim868_mux_rx_len ) sim868_mux_rx_state = SIM868_MUX_RX_FCS;
+		break;
+		
+		case SIM868_MUX_RX_FCS:
+			sim868_mux_rx_fcs = sim868_mux_crc( sim868_mux_rx_fcs, data );
+			sim868_mux_rx_state = SIM868_MUX_RX_END;
+		break;
+		
+		case SIM868_MUX_RX_END:
+			if( (data == SIM868_MUX_FLAG) && (sim868_mux_rx_fcs == SIM868_MUX_FCS_GOOD) ) sim868_mux_frame();
+			else sim868_mux_stat[ SIM868_MUX_CONTROL ].errors++;
+			sim868_mux_rx_state = ( data == SIM868_MUX_FLAG ) ? SIM868_MUX_RX_ADDRESS : SIM868_MUX_RX_FLAG;
+		break;
+	}
 }
 
+void sim868_mux_frame(void)
+{
+	unsigned char dlci = sim868_mux_rx_address >> 2;
+	unsigned char control = sim868_mux_rx_control & ~SIM868_MUX_PF;
+	sim868_mux_stat_t* stat;
+	
+	if( dlci >= SIM868_MUX_CHANNELS ) return;
+	stat = &sim868_mux_stat[ dlci ];
+	stat->rx_frames++;
+	
+	switch( control )
+	{
+		case SIM868_MUX_UA:
+		case SIM868_MUX_DM:
+			if( dlci == sim868_mux_ack_dlci ) sim868_mux_ack = control;
+			if( control == SIM868_MUX_DM ) stat->open = 0;
+		break;
+		
+		case SIM868_MUX_DISC:
+			stat->open = 0;
+		break;
+		
+		case SIM868_MUX_UIH:
+		case SIM868_MUX_UI:
+			stat->rx_bytes += sim868_mux_rx_len;
+			
+			for( unsigned char i=0; i<sim868_mux_rx_len; i++ )
+			{
+				char data = sim868_mux_rx_buf[i];
+				
+				switch( dlci )
+				{
+					case SIM868_MUX_AT:
+						sim868_rx_ring_put( data );
+					break;
+					
+					case SIM868_MUX_NMEA:
+						if( !sim868_nmea_divert( data ) ) sim868_mux_ring_put( dlci, data );
+					break;
+					
+					case SIM868_MUX_DATA:
+						sim868_mux_ring_put( dlci, data );
+					break;
+				}
+			}
+			
+			if( dlci == SIM868_MUX_CONTROL ) sim868_mux_control( sim868_mux_rx_buf, sim868_mux_rx_len );
+		break;
+	}
+}
 
+//MSC and FCon/FCoff from the module, answered by sim868_mux_update()
+void sim868_mux_control( const unsigned char* data, unsigned char len )
+{
+	if( len < 2 ) return;
+	
+	switch( data[0] )
+	{
+		case SIM868_MUX_MSC_COMMAND:
+			if( len < 4 ) break;
+			if( data[3] & SIM868_MUX_V24_FC ) sim868_mux_flow |= 1 << ( (data[2] >> 2) & 0x07 );
+			else sim868_mux_flow &= ~( 1 << ((data[2] >> 2) & 0x07) );
+			sim868_mux_msc_address = data[2];
+			sim868_mux_msc_signals = data[3];
+			sim868_mux_reply |= SIM868_MUX_REPLY_MSC;
+		break;
+		
+		case SIM868_MUX_FCOFF_COMMAND:
+			sim868_mux_flow |= SIM868_MUX_FLOW_ALL;
+			sim868_mux_reply |= SIM868_MUX_REPLY_FCOFF;
+		break;
+		
+		case SIM868_MUX_FCON_COMMAND:
+			sim868_mux_flow &= ~SIM868_MUX_FLOW_ALL;
+			sim868_mux_reply |= SIM868_MUX_REPLY_FCON;
+		break;
+	}
+}
 
-ISR (usart_interrupt_vector)
+void sim868_mux_ring_put( unsigned char channel, char data )
 {
-	usart_received_byte_get( sim868_readed_char );
-	if( sim868_responce_buf_len < sim868_responce_buf_len_max )
+	unsigned char index = channel - SIM868_MUX_NMEA;
+	unsigned char head = sim868_mux_ring_head[ index ];
+	unsigned char next = ( head + 1 ) & SIM868_MUX_RING_MASK;
+	
+	if( next == sim868_mux_ring_tail[ index ] )
 	{
-		sim868_responce_buf[ sim868_responce_buf_len++ ] = sim868_readed_char;
-	}	
+		sim868_mux_stat[ channel ].dropped++;
+		return;
+	}
+	
+	sim868_mux_ring[ index ][ head ] = data;
+	sim868_mux_ring_head[ index ] = next;
 }
 
 
 
 void sim868_init(void)
 {
+	unsigned char warm;
+	
 	interrupts_global_dis();
 	
 	usart_reset_full();
@@ -619,7 +4580,9 @@ void sim868_init(void)
 	
 	usart_regs_clr();
 	
-	usart_baudrate_put( SIM868_BAUDRATE );
+	sim868_baudrate = SIM868_BAUDRATE;
+	warm = sim868_warm_restore();
+	usart_baudrate_put( sim868_baudrate );
 	
 	usart_transmitter_ports_init();
 	usart_transmitter_en();
@@ -634,9 +4597,130 @@ void sim868_init(void)
 		
 	interrupts_global_en();
 	
-	_delay_ms(1000);
+	if( warm != GOOD_CODE ) _delay_ms(1000);
+	
+	if( sim868_power_en() == GOOD_CODE ) sim868_baudrate_negotiate();
+}
+
+
+
+unsigned long sim868_baudrate_get(void)
+{
+	return sim868_baudrate;
+}
+
+void sim868_baudrate_set( unsigned long baudrate )
+{
+	sim868_tx_flush();
+	usart_baudrate_put( baudrate );
+	sim868_baudrate = baudrate;
+	sim868_rx_read( 0, SIM868_RX_RING_SIZE, 0 );	//garbage received at the old rate
+}
+
+//UBRR rate error at F_CPU within SIM868_BAUDRATE_ERROR
+unsigned char sim868_baudrate_accurate( unsigned long baudrate )
+{
+	unsigned long ubrr = ( F_CPU + 8 * baudrate ) / ( 16 * baudrate );
+	unsigned long real;
+	unsigned long diff;
+	
+	if( !ubrr ) return 0;
+	
+	real = F_CPU / ( 16 * ubrr );
+	diff = ( real > baudrate ) ? ( real - baudrate ) : ( baudrate - real );
+	
+	return ( diff * 1000 <= baudrate * SIM868_BAUDRATE_ERROR );
+}
+
+unsigned char sim868_baudrate_probe(void)
+{
+	sim868_command_t command = { 0 };
+	command.command = sim868_command__at;
+	command.responce = sim868_data__error;
+	command.timeout = 75;
+	command.lineout = 2;
+	
+	if( sim868_command_wait( &command ) == GOOD_CODE ) return GOOD_CODE;
+	
+	return sim868_command_wait( &command );
+}
+
+//Finds the rate the module answers at, current rate first
+unsigned char sim868_baudrate_sync(void)
+{
+	if( sim868_baudrate_probe() == GOOD_CODE ) return GOOD_CODE;
+	
+	for( unsigned char i=0; i<SIM868_BAUDRATE_TABLE_SIZE; i++ )
+	{
+		unsigned long baudrate = pgm_read_dword( &sim868_baudrate_table[i] );
+		
+		if( (baudrate > SIM868_BAUDRATE_MAX) || !sim868_baudrate_accurate( baudrate ) ) continue;
+		
+		sim868_baudrate_set( baudrate );
+		if( sim868_baudrate_probe() == GOOD_CODE ) return GOOD_CODE;
+	}
+	
+	sim868_baudrate_set( SIM868_BAUDRATE );
+	
+	return ERROR_CODE;
+}
+
+//Raises the rate with AT+IPR to the fastest one F_CPU makes accurately, falls back to the old rate
+unsigned char sim868_baudrate_negotiate(void)
+{
+	unsigned long baudrate_old = sim868_baudrate;
+	unsigned long baudrate = 0;
+	unsigned char found = 0;
+	
+	for( unsigned char i=0; i<SIM868_BAUDRATE_TABLE_SIZE; i++ )
+	{
+		baudrate = pgm_read_dword( &sim868_baudrate_table[i] );
+		if( (baudrate > SIM868_BAUDRATE_MAX) || !sim868_baudrate_accurate( baudrate ) ) continue;
+		
+		found = 1;
+		break;
+	}
+	
+	if( !found || (baudrate <= baudrate_old) ) return GOOD_CODE;	//no rate F_CPU makes accurately, the old one stays
+	
+	sim868_baudrate = baudrate;	//printed by sim868_baudrate_ipr_print()
+	
+	sim868_command_t command = { 0 };
+	sim868_command_load( &command, SIM868_CMD_IPR );
+	command.print = sim868_baudrate_ipr_print;
+	command.lineout = 2;
+	
+	if( sim868_command_wait( &command ) )
+	{
+		sim868_baudrate = baudrate_old;
+		return ERROR_CODE;
+	}
+	
+	sim868_baudrate_set( baudrate );
+	sim868_pause( 100/SIM868_TIMEOUT_TICK );
+	if( sim868_baudrate_probe() == GOOD_CODE ) return GOOD_CODE;
+	
+	sim868_baudrate_set( baudrate_old );
+	if( sim868_baudrate_probe() == GOOD_CODE ) return ERROR_CODE;
+	
+	sim868_baudrate_sync();
+	
+	return ERROR_CODE;
+}
+
+void sim868_baudrate_ipr_print(void)
+{
+	char text[ 8 ];
+	unsigned char len = 0;
+	unsigned long baudrate = sim868_baudrate;
+	
+	do
+	{
+		text[ len++ ] = '0' + baudrate % 10;
+		baudrate /= 10;
+	} while( baudrate );
 	
-	sim868_power_en();
+	while( len ) sim868_print_char( text[ --len ] );
 }
 
 
@@ -649,11 +4733,104 @@ void sim868_get_char(char *data)
 }
 
 void sim868_print_char(char data)
+{
+	sim868_tx_bytes++;
+	
+	if( sim868_mux_state == SIM868_MUX_ON ) sim868_mux_char( SIM868_MUX_AT, data );
+	else sim868_tx_char( data );
+}
+
+#ifdef SIM868_TX_QUEUE
+//Byte to the usart as is, below the multiplexer. A full ring is waited for only with global
+//interrupts on, otherwise nothing frees it and the byte is dropped to sim868_tx_overflow
+void sim868_tx_char( char data )
+{
+	while( ((sim868_tx_head + 1) & SIM868_TX_RING_MASK) == sim868_tx_tail )	//full, the ISR frees it
+	{
+		if( !(SREG & (1 << SREG_I)) )
+		{
+			sim868_tx_overflow++;
+			return;
+		}
+	}
+	
+	sim868_tx_ring[ sim868_tx_head ] = data;
+	sim868_tx_head = ( sim868_tx_head + 1 ) & SIM868_TX_RING_MASK;
+	sim868_tx_put( 0, 1 );
+}
+
+//Queues len bytes of the PROGMEM data, or the last len bytes put to sim868_tx_ring if data is 0
+void sim868_tx_put( const char* data, unsigned int len )
+{
+	unsigned char last;
+	
+	for(;;)
+	{
+		usart_empty_intr_dis();
+		
+		last = ( sim868_tx_segment_head - 1 ) & SIM868_TX_SEGMENT_MASK;
+		if( !data && (sim868_tx_segment_head != sim868_tx_segment_tail) && !sim868_tx_segment[ last ].data )
+		{
+			sim868_tx_segment[ last ].len += len;
+			break;
+		}
+		if( ((sim868_tx_segment_head + 1) & SIM868_TX_SEGMENT_MASK) != sim868_tx_segment_tail )
+		{
+			sim868_tx_segment[ sim868_tx_segment_head ].data = data;
+			sim868_tx_segment[ sim868_tx_segment_head ].len = len;
+			sim868_tx_segment_head = ( sim868_tx_segment_head + 1 ) & SIM868_TX_SEGMENT_MASK;
+			break;
+		}
+		if( !(SREG & (1 << SREG_I)) )	//no segment is freed with global interrupts off
+		{
+			if( !data ) sim868_tx_head = ( sim868_tx_head - len ) & SIM868_TX_RING_MASK;
+			sim868_tx_overflow += len;
+			break;
+		}
+		
+		usart_empty_intr_en();	//full, wait for the ISR
+	}
+	
+	usart_empty_intr_en();
+}
+
+unsigned char sim868_tx_busy(void)
+{
+	return ( sim868_tx_segment_head != sim868_tx_segment_tail );
+}
+
+//Waits until the last byte has left the usart, before a baud rate change. With global
+//interrupts off the queue is not drained and what is left in it goes out later
+void sim868_tx_flush(void)
+{
+	sim868_mux_flush();
+	while( sim868_tx_busy() && (SREG & (1 << SREG_I)) );
+	while( usart_busy_get() );
+}
+#else
+void sim868_tx_char( char data )
 {
 	usart_transmite_byte_put( data );
 	while( !usart_transmitted_get() );
 }
 
+void sim868_tx_put( const char* data, unsigned int len )
+{
+	for( unsigned int i=0; data && (i<len); i++ ) sim868_tx_char( (char)pgm_read_byte( &data[i] ) );
+}
+
+unsigned char sim868_tx_busy(void)
+{
+	return 0;
+}
+
+void sim868_tx_flush(void)
+{
+	sim868_mux_flush();
+	while( usart_busy_get() );
+}
+#endif
+
 
 
 void sim868_print_newstr(void)
@@ -664,10 +4841,22 @@ void sim868_print_newstr(void)
 
 void sim868_print_progmem(const char* data)
 {
-	for(unsigned int i=0; (char)pgm_read_byte( &data[i] ); i++)
+	sim868_print_progmem_by_len( data, strlen_P( data ) );
+}
+
+//Sent straight from flash by the ISR, copied to frames under the multiplexer
+void sim868_print_progmem_by_len( const char* data, unsigned int len )
+{
+	if( !len ) return;
+	
+	if( sim868_mux_state == SIM868_MUX_ON )
 	{
-		sim868_print_char(  (char) pgm_read_byte( &data[i] )  );
+		for( unsigned int i=0; i<len; i++ ) sim868_print_char( (char)pgm_read_byte( &data[i] ) );
+		return;
 	}
+	
+	sim868_tx_bytes += len;
+	sim868_tx_put( data, len );
 }
 
 void sim868_print_chararr(char* data)
@@ -16,20 +16,476 @@ extern "C" {
 
 	
 	#include "../config/sim868_config.h"
-	char sim868_buffer[ SIM868_BUFFER_SIZE ];
+	extern char sim868_buffer[ SIM868_BUFFER_SIZE ];
+	
+	typedef void (*sim868_callback_t)( unsigned char code );
+	
+	#define SIM868_COMMAND_FLAG_DEFERRED	0x01	//expected responce comes after OK, as HTTPACTION
+	#define SIM868_COMMAND_FLAG_RAW			0x02	//only print() is sent, without "AT+" and newline
+	#define SIM868_COMMAND_FLAG_DATA		0x04	//wait for length bytes stored to data, not to the responce buffer
+	#define SIM868_COMMAND_FLAG_PROMPT		0x08	//done when the responce is matched, without line end, as "> "
+	#define SIM868_COMMAND_FLAG_BINARY		0x10	//responce is followed by raw data, read by the next DATA command
+	
+	typedef struct
+	{
+		const char*   prefix;		//PROGMEM text after "AT+", 0 if none
+		const char*   command;		//PROGMEM command, 0 for wait only descriptor
+		unsigned char id;			//SIM868_CMD_* when command is a whole line of sim868_command_table, 0 if not
+		void          (*print)(void);	//prints the rest of command line, may be 0
+		const char*   responce;		//PROGMEM expected responce, 0 if not checked
+		unsigned char responce_len;	//length of responce if known, 0 to count it
+		unsigned int  length;		//wait for this many bytes, 0 if not used
+		unsigned int  timeout;		//ticks
+		unsigned char lineout;		//stop after this many lines, 0 if not used
+		unsigned char flags;		//SIM868_COMMAND_FLAG_*
+		sim868_callback_t callback;	//called with GOOD_CODE or ERROR_CODE, may be 0
+		char*         data;			//destination of SIM868_COMMAND_FLAG_DATA
+	} sim868_command_t;
+	
+	typedef struct
+	{
+		unsigned int  lines;		//joined lines sent
+		unsigned int  commands;		//commands put to batches
+		unsigned int  fallbacks;	//lines failed and sent again one command at a time
+	} sim868_batch_stat_t;
+	
+	typedef void (*sim868_request_callback_t)( unsigned char code, unsigned int responce_len );
+	typedef char (*sim868_body_source_t)( unsigned int offset );
+	
+	#define SIM868_BODY_RAM			0
+	#define SIM868_BODY_PROGMEM		1
+	#define SIM868_BODY_SOURCE		2	//bytes are taken from source() one by one
+	
+	//POST body, streamed to the modem after the DOWNLOAD prompt without a copy
+	typedef struct
+	{
+		const char*   data;			//RAM or PROGMEM, 0 for SIM868_BODY_SOURCE
+		unsigned int  len;
+		unsigned char type;
+		sim868_body_source_t source;
+		const char*   content;		//PROGMEM content type as sim868_data__content_octet, 0 for application/x-www-form-urlencoded
+	} sim868_body_t;
+	
+	typedef void (*sim868_sink_callback_t)( unsigned int offset, const char* data, unsigned int len );
+	
+	//Responce body destination, read with AT+HTTPREAD=<offset>,<size> windows
+	typedef struct
+	{
+		char*         data;			//caller buffer, used when callback is 0
+		unsigned int  size;
+		sim868_sink_callback_t callback;	//gets SIM868_HTTPREAD_WINDOW windows from sim868_buffer
+	} sim868_sink_t;
+	
+	typedef struct
+	{
+		const char*   host;
+		const char*   path;
+		const char*   params;
+		sim868_body_t body;			//len 0 for GET
+		sim868_sink_t sink;			//sim868_buffer if not given
+		sim868_request_callback_t callback;	//responce is in sim868_buffer during the call, may be 0
+		unsigned long tick;			//queued at, set by sim868_request_put()
+		unsigned long deadline;		//ticks after tick it may wait for signal, 0 to send at once
+		unsigned char deferred;		//held for signal at least once
+		unsigned char sent;			//HTTPACTION uploads, the later ones are retransmissions
+	} sim868_request_t;
+	
+	//Drain rate is count / total, per request latency is last, max and ( wait_total + total ) / count
+	typedef struct
+	{
+		unsigned int  count;
+		unsigned int  errors;
+		unsigned int  opens;		//bearer and HTTP service setups
+		unsigned long last;			//ticks of the last request
+		unsigned long max;
+		unsigned long total;
+		unsigned long wait_total;	//ticks spent in the queue
+		unsigned long tx_bytes;		//UART bytes sent for requests, commands and bodies
+		unsigned char depth;		//requests queued now
+		unsigned char depth_max;
+	} sim868_request_stat_t;
+	
+	#define SIM868_SOCKET_TCP			0
+	#define SIM868_SOCKET_UDP			1
+	
+	#define SIM868_SOCKET_CLOSED		0
+	#define SIM868_SOCKET_OPENING		1
+	#define SIM868_SOCKET_OPEN			2
+	#define SIM868_SOCKET_TRANSPARENT	3	//CIPMODE=1, use sim868_socket_write/read
+	#define SIM868_SOCKET_EXIT			4	//leaving transparent mode
+	
+	typedef void (*sim868_socket_callback_t)( unsigned char code, unsigned int len );
+	
+	//Compare tx_bytes / sent with sim868_request_stat_t for the HTTP overhead
+	typedef struct
+	{
+		unsigned int  opens;
+		unsigned int  sends;
+		unsigned int  errors;
+		unsigned long sent;			//payload bytes
+		unsigned long received;
+		unsigned long tx_bytes;		//UART bytes sent for socket operations
+		unsigned long send_last;	//ticks from sim868_socket_send() to SEND OK
+		unsigned long send_max;
+	} sim868_socket_stat_t;
+	
+	//Unsolicited result codes, dispatched from sim868_urc_table to driver handlers and then to sim868_urc_callback_set()
+	#define SIM868_URC_ECHO				0	//"AT" echo, power up only, not passed to the callback
+	#define SIM868_URC_OK				1	//OK outside of a command, not passed to the callback
+	#define SIM868_URC_RDY				2
+	#define SIM868_URC_CFUN				3
+	#define SIM868_URC_CPIN				4
+	#define SIM868_URC_CALL_READY		5
+	#define SIM868_URC_SMS_READY		6
+	#define SIM868_URC_CREG				7
+	#define SIM868_URC_CMTI				8
+	#define SIM868_URC_PDP_DEACT		9
+	#define SIM868_URC_BEARER_DEACT		10
+	#define SIM868_URC_POWER_DOWN		11
+	#define SIM868_URC_UNDER_VOLTAGE	12
+	#define SIM868_URC_OVER_VOLTAGE		13
+	#define SIM868_URC_SOCKET_DATA		14
+	#define SIM868_URC_SOCKET_CLOSED	15
+	#define SIM868_URC_HTTPACTION		16	//late HTTPACTION result, the request has timed out
+	#define SIM868_URC_CSQ				17	//answer to AT+CSQ
+	
+	typedef void (*sim868_urc_callback_t)( unsigned char id, const char* line, unsigned char len );
+	
+	typedef struct
+	{
+		unsigned int  dispatched;
+		unsigned int  in_command;	//taken out of a command responce
+	} sim868_urc_stat_t;
+	
+	//GSM 07.10 multiplexer channels, by DLCI
+	#define SIM868_MUX_CONTROL			0
+	#define SIM868_MUX_AT				1	//command queue
+	#define SIM868_MUX_NMEA				2	//CGNSTST sentences to the NMEA parser, other lines to sim868_mux_read()
+	#define SIM868_MUX_DATA				3	//raw bytes, sim868_mux_write() and sim868_mux_read()
+	#define SIM868_MUX_CHANNELS			4
+	
+	#define SIM868_MUX_OFF				0
+	#define SIM868_MUX_STARTING			1	//CMUX accepted, channels being opened
+	#define SIM868_MUX_ON				2
+	
+	typedef struct
+	{
+		unsigned long rx_bytes;
+		unsigned long tx_bytes;
+		unsigned int  rx_frames;
+		unsigned int  tx_frames;
+		unsigned int  dropped;		//received bytes lost on a full ring
+		unsigned int  blocked;		//frames held by flow control
+		unsigned int  refused;		//bytes not taken while SIM868_MUX_TX_FRAMES frames were held
+		unsigned int  errors;		//control channel only: frames with bad FCS or size
+		unsigned char open;
+	} sim868_mux_stat_t;
+	
+	//Network registration, +CREG: <stat>
+	#define SIM868_REG_NOT				0
+	#define SIM868_REG_HOME				1
+	#define SIM868_REG_SEARCHING		2
+	#define SIM868_REG_DENIED			3
+	#define SIM868_REG_UNKNOWN			4
+	#define SIM868_REG_ROAMING			5
+	#define SIM868_REG_NONE				0xFF	//not reported since power up
+	
+	typedef struct
+	{
+		unsigned long tick;			//sim868_tick of the last report
+		unsigned int  lac;			//location area code
+		unsigned int  cell;			//cell ID
+		unsigned int  reports;		//+CREG lines seen
+		unsigned int  polls;		//AT+CREG? sent by requests
+		unsigned char status;		//SIM868_REG_*
+		unsigned char changes;		//status changes
+	} sim868_reg_t;
+	
+	//Signal quality, +CSQ: <rssi>,<ber>
+	#define SIM868_SIGNAL_UNKNOWN		99
+	
+	typedef struct
+	{
+		unsigned long tick;			//sim868_tick of the last sample
+		unsigned char rssi;			//-113 + 2 * rssi dBm, 0..31
+		unsigned char ber;			//RXQUAL, 0..7
+	} sim868_signal_t;
+	
+	//Success rate is delivered / ( delivered + failed ), charge / delivered_bytes is the cost of a byte
+	typedef struct
+	{
+		unsigned long deferred_ticks;	//ticks deferred requests spent in the queue
+		unsigned long delivered_bytes;	//bodies of good requests
+		unsigned long retransmitted;	//body bytes uploaded again for the same request
+		unsigned long charge;		//mC, SIM868_REQUEST_CURRENT_MA over the time of each request
+		unsigned int  samples;		//AT+CSQ sent
+		unsigned int  good;			//samples over the thresholds
+		unsigned int  deferred;		//requests held for signal
+		unsigned int  overrides;	//requests sent on their deadline with bad signal
+		unsigned int  delivered;
+		unsigned int  failed;
+	} sim868_signal_stat_t;
+	
+	#define SIM868_POWER_OFF			0
+	#define SIM868_POWER_PROBE			1
+	#define SIM868_POWER_PULSE_HIGH		2
+	#define SIM868_POWER_PULSE_LOW		3
+	#define SIM868_POWER_ALIVE			4	//waits for AT echo or RDY
+	#define SIM868_POWER_CFUN			5
+	#define SIM868_POWER_CPIN			6
+	#define SIM868_POWER_CALL			7
+	#define SIM868_POWER_SMS			8
+	#define SIM868_POWER_READY			9
+	#define SIM868_POWER_FAIL			10
+	#define SIM868_POWER_PHASES			( SIM868_POWER_READY - SIM868_POWER_ALIVE )
+	
+	#define SIM868_POWER_SIGNAL_AT		0x01	//echo or answer to "AT"
+	#define SIM868_POWER_SIGNAL_RDY		0x02
+	#define SIM868_POWER_SIGNAL_CFUN	0x04	//+CFUN: 1
+	#define SIM868_POWER_SIGNAL_CPIN	0x08	//+CPIN: READY
+	#define SIM868_POWER_SIGNAL_CALL	0x10	//Call Ready
+	#define SIM868_POWER_SIGNAL_SMS		0x20	//SMS Ready
+	
+	typedef struct
+	{
+		unsigned long boot;			//ticks from power up start to SIM868_POWER_READY
+		unsigned long first_request;	//ticks from power up start to the end of the first request
+		unsigned int  phase[ SIM868_POWER_PHASES ];	//ticks from SIM868_POWER_ALIVE to SMS
+		unsigned char timeouts;		//phases left without their signal
+		unsigned char attempts;		//PWRKEY pulses
+		unsigned char signals;		//SIM868_POWER_SIGNAL_*
+	} sim868_power_stat_t;
+	
+	//Recovery ladder, each failed request moves it one step up until a request is good again
+	#define SIM868_RECOVER_NONE			0
+	#define SIM868_RECOVER_RETRY		1	//request runs again
+	#define SIM868_RECOVER_SESSION		2	//HTTPTERM and SAPBR=0,1 before it
+	#define SIM868_RECOVER_CFUN			3	//AT+CFUN=1,1, then the power up URCs
+	#define SIM868_RECOVER_POWER		4	//EN pin power cycle
+	#define SIM868_RECOVER_WATCHDOG		5	//MCU reset, driver and session state kept in .noinit
+	#define SIM868_RECOVER_STEPS		5
+	
+	typedef struct
+	{
+		unsigned long ticks[ SIM868_RECOVER_STEPS ];	//last time from the first failure to a good request, by the highest step taken
+		unsigned int  count[ SIM868_RECOVER_STEPS ];	//recoveries ended after each step
+		unsigned int  failures;		//requests failed
+		unsigned char restarts;		//warm restarts taken back after a watchdog reset
+		unsigned char step;			//SIM868_RECOVER_*, highest step taken since the first failure
+	} sim868_recover_stat_t;
+	
+	//Operation classes retried with their own policy
+	#define SIM868_RETRY_REG			0	//AT+CREG? until registered
+	#define SIM868_RETRY_BEARER			1	//SAPBR open and close
+	#define SIM868_RETRY_HTTP			2	//HTTPINIT and HTTPACTION
+	#define SIM868_RETRY_GNSS			3	//AT+CGNSINF
+	#define SIM868_RETRY_CLASSES		4
+	#define SIM868_RETRY_NONE			0xFF
+	
+	//Backoff before retry n is min( base << (n-1), max ), a random half of it is dropped
+	typedef struct
+	{
+		unsigned char attempts;		//first one included
+		unsigned int  base;			//ticks
+		unsigned int  max;			//ticks
+		unsigned long deadline;		//ticks from the first attempt, 0 if none
+	} sim868_retry_policy_t;
+	
+	typedef struct
+	{
+		unsigned long backoff;		//ticks waited between attempts
+		unsigned int  attempts;
+		unsigned int  successes;
+		unsigned int  failures;		//given up, attempts or deadline
+		unsigned int  deadlines;	//given up on the deadline
+	} sim868_retry_stat_t;
+	
+	//Module sleep between transactions, AT+CSCLK
+	#define SIM868_SLEEP_AWAKE			0
+	#define SIM868_SLEEP_ENTER			1	//AT+CSCLK sent
+	#define SIM868_SLEEP_ASLEEP			2	//DTR high or UART left idle
+	#define SIM868_SLEEP_WAKE			3	//DTR low or dummy byte sent, the next command waits SIM868_SLEEP_WAKE_TICK
+	
+	typedef struct
+	{
+		unsigned long asleep;		//ticks
+		unsigned long latency;		//ticks from each wake to the first responce byte, summed
+		unsigned int  latency_last;
+		unsigned int  latency_max;
+		unsigned int  sleeps;
+		unsigned int  wakes;
+	} sim868_sleep_stat_t;
+	
+	//+CGNSINF: field numbers, bit n of sim868_fix_t.fields is set when field n was not empty
+	#define SIM868_FIX_FIELD_RUN			0
+	#define SIM868_FIX_FIELD_FIX			1
+	#define SIM868_FIX_FIELD_UTC			2
+	#define SIM868_FIX_FIELD_LATITUDE		3
+	#define SIM868_FIX_FIELD_LONGITUDE		4
+	#define SIM868_FIX_FIELD_ALTITUDE		5
+	#define SIM868_FIX_FIELD_SPEED			6
+	#define SIM868_FIX_FIELD_COURSE			7
+	#define SIM868_FIX_FIELD_MODE			8
+	#define SIM868_FIX_FIELD_HDOP			10
+	#define SIM868_FIX_FIELD_PDOP			11
+	#define SIM868_FIX_FIELD_VDOP			12
+	#define SIM868_FIX_FIELD_SATS_VIEW		14
+	#define SIM868_FIX_FIELD_SATS_GNSS		15
+	#define SIM868_FIX_FIELD_SATS_GLONASS	16
+	#define SIM868_FIX_FIELD_CN0			18
+	#define SIM868_FIX_FIELD_HPA			19
+	#define SIM868_FIX_FIELD_VPA			20
+	#define SIM868_FIX_FIELDS				21
+	
+	//GNSS fix, fixed-point without floats, widest members first so there is no padding
+	typedef struct
+	{
+		long          latitude;		//degrees * 1000000, south negative
+		long          longitude;	//degrees * 1000000, west negative
+		long          altitude;		//MSL meters * 100
+		unsigned long fields;		//1 << SIM868_FIX_FIELD_*
+		unsigned int  year;
+		unsigned int  millisecond;
+		unsigned int  speed;		//km/h * 100
+		unsigned int  course;		//degrees * 10
+		unsigned int  hdop;			//* 10
+		unsigned int  pdop;			//* 10
+		unsigned int  vdop;			//* 10
+		unsigned int  hpa;			//meters * 10
+		unsigned int  vpa;			//meters * 10
+		unsigned char month;
+		unsigned char day;
+		unsigned char hour;
+		unsigned char minute;
+		unsigned char second;
+		unsigned char run;			//GNSS power
+		unsigned char fix;			//1 if position is valid
+		unsigned char mode;
+		unsigned char sats_view;
+		unsigned char sats_gnss;
+		unsigned char sats_glonass;
+		unsigned char cn0;			//max C/N0, dB-Hz
+	} sim868_fix_t;
+	
+	typedef struct
+	{
+		unsigned int  sentences;	//RMC and GGA with a good checksum
+		unsigned int  errors;		//checksum errors
+	} sim868_nmea_stat_t;
+	
+	//Served count is hits + misses, modem exchanges are misses
+	typedef struct
+	{
+		unsigned int  hits;			//served from the cache
+		unsigned int  predictions;	//hits moved by speed and course
+		unsigned int  misses;		//fix taken from the modem
+		unsigned int  errors;		//misses without a valid fix
+	} sim868_fix_cache_stat_t;
+	
+	//Bytes per point is bytes / points
+	typedef struct
+	{
+		unsigned int  points;		//uploaded
+		unsigned int  dropped;		//track buffer was full
+		unsigned int  uploads;
+		unsigned int  errors;
+		unsigned long bytes;		//uploaded bodies
+	} sim868_track_stat_t;
+	
+	//Records per upload is delivered / batches
+	typedef struct
+	{
+		unsigned long bytes;		//uploaded bodies
+		unsigned int  appended;
+		unsigned int  delivered;	//records acknowledged and reclaimed
+		unsigned int  batches;		//uploads acknowledged
+		unsigned int  errors;		//uploads failed, records kept
+		unsigned int  dropped;		//outbox was full
+		unsigned int  corrupt;		//records with a bad checksum, reclaimed unsent
+		unsigned char depth_max;
+	} sim868_outbox_stat_t;
 		
 		
 	void sim868_init(void);
 	void sim868_update(void);
 	void sim868_example_request(void);
 	
+	unsigned char sim868_command_put( const sim868_command_t* command );
+	void sim868_command_load( sim868_command_t* command, unsigned char id );
+	void sim868_command_responce_set( sim868_command_t* command, unsigned char responce );
+	unsigned char sim868_command_busy(void);
+	unsigned char sim868_batch_put( const sim868_command_t* commands, unsigned char count, sim868_callback_t callback );
+	const sim868_batch_stat_t* sim868_batch_stat_get(void);
+	
+	unsigned char sim868_rx_lines(void);
+	unsigned int  sim868_rx_overflow_get(void);
+	unsigned int  sim868_tx_overflow_get(void);
+	
 	unsigned char sim868_request_get_send( const char* host, const char* path, const char* params, unsigned int *responce_len );
 	unsigned char sim868_request_get_end(void);
+	unsigned char sim868_request_put( const char* host, const char* path, const char* params, sim868_request_callback_t callback );
+	unsigned char sim868_request_post_put( const char* host, const char* path, const char* params, const sim868_body_t* body, sim868_request_callback_t callback );
+	unsigned char sim868_request_read_put( const char* host, const char* path, const char* params, const sim868_sink_t* sink, sim868_request_callback_t callback );
+	unsigned char sim868_request_post_send( const char* host, const char* path, const char* params, const sim868_body_t* body, unsigned int *responce_len );
+	unsigned char sim868_request_defer( unsigned long deadline );
+	unsigned char sim868_request_busy(void);
+	const sim868_request_stat_t* sim868_request_stat_get(void);
+	unsigned int  sim868_request_status_get(void);
+	
+	unsigned char sim868_socket_open( unsigned char type, const char* host, unsigned int port, unsigned char transparent, sim868_socket_callback_t callback );
+	unsigned char sim868_socket_send( const char* data, unsigned int len, sim868_socket_callback_t callback );
+	unsigned char sim868_socket_receive( char* data, unsigned int size, sim868_socket_callback_t callback );
+	unsigned char sim868_socket_close( sim868_socket_callback_t callback );
+	unsigned char sim868_socket_state_get(void);
+	unsigned char sim868_socket_available(void);
+	unsigned int  sim868_socket_write( const char* data, unsigned int len );
+	unsigned int  sim868_socket_read( char* data, unsigned int size );
+	const sim868_socket_stat_t* sim868_socket_stat_get(void);
+	unsigned long sim868_tick_get(void);
+	unsigned long sim868_baudrate_get(void);
+	unsigned char sim868_power_state_get(void);
+	void sim868_urc_callback_set( sim868_urc_callback_t callback );
+	const sim868_urc_stat_t* sim868_urc_stat_get(void);
+	const sim868_power_stat_t* sim868_power_stat_get(void);
+	const sim868_recover_stat_t* sim868_recover_stat_get(void);
+	unsigned char sim868_reset_cause_get(void);	//MCUSR at startup, the driver clears it in its .init3 hook sim868_wdt_init()
+	void sim868_retry_policy_set( unsigned char id, const sim868_retry_policy_t* policy );
+	const sim868_retry_stat_t* sim868_retry_stat_get( unsigned char id );
+	unsigned char sim868_sleep_state_get(void);
+	const sim868_sleep_stat_t* sim868_sleep_stat_get(void);
+	const sim868_reg_t* sim868_reg_get(void);
+	const sim868_signal_t* sim868_signal_get(void);
+	const sim868_signal_stat_t* sim868_signal_stat_get(void);
+	unsigned char sim868_mux_en(void);
+	void sim868_mux_dis(void);
+	unsigned char sim868_mux_state_get(void);
+	unsigned int  sim868_mux_write( unsigned char channel, const char* data, unsigned int len );
+	unsigned int  sim868_mux_read( unsigned char channel, char* data, unsigned int size );
+	const sim868_mux_stat_t* sim868_mux_stat_get( unsigned char channel );
+	unsigned char sim868_reg_registered(void);
 	
 	unsigned char sim868_get_location( char* latitude, unsigned char* latitude_len, char* longtitude, unsigned char* longtitude_len );
+	unsigned char sim868_cgnsinf_get( sim868_fix_t* fix );
+	unsigned char sim868_nmea_en(void);
+	unsigned char sim868_nmea_dis(void);
+	unsigned char sim868_nmea_fix_get( sim868_fix_t* fix );
+	void sim868_nmea_stat_get( sim868_nmea_stat_t* stat );
+	unsigned char sim868_fix_get( sim868_fix_t* fix, unsigned long max_age );
+	unsigned char sim868_fix_cache_get( unsigned char index, sim868_fix_t* fix, unsigned long* tick );
+	const sim868_fix_cache_stat_t* sim868_fix_cache_stat_get(void);
+	
+	void sim868_track_begin( const char* host, const char* path, const char* params );
+	unsigned char sim868_track_put( const sim868_fix_t* fix );
+	unsigned int  sim868_track_len_get(void);
+	const sim868_track_stat_t* sim868_track_stat_get(void);
+	void sim868_outbox_begin( const char* host, const char* path, const char* params );
+	unsigned char sim868_outbox_put( const void* data, unsigned char len );
+	unsigned char sim868_outbox_depth_get(void);
+	const sim868_outbox_stat_t* sim868_outbox_stat_get(void);
 	
 	void sim868_print_newstr(void);
 	void sim868_print_progmem( const char* data );
+	void sim868_print_progmem_by_len( const char* data, unsigned int len );
 	void sim868_print_chararr( char* data );
 	void sim868_print_chararr_by_len( char* data, unsigned int len );
 	void sim868_print_uint( unsigned int numb );
@@ -0,0 +1,71 @@
+/*
+ * sim868_data.c
+ *
+ * Flash texts and tables of the sim868 driver, declared in sim868_data.h
+ */ 
+
+#include "../config/ide_config.h"
+#include <avr/pgmspace.h>
+
+#include "sim868.h"
+#include "sim868_data.h"
+#include "../config/sim868_config.h"
+
+
+
+#define X( name, text )		const char name[ sizeof(text) ] PROGMEM = text;
+SIM868_DATA_LIST
+#undef X
+
+
+
+const sim868_responce_pattern_t sim868_responce_table[ SIM868_RESP_COUNT ] PROGMEM =
+{
+	{ 0, 0 },
+	#define X( id, text )		{ text, sizeof(text) - 1 },
+	SIM868_RESPONCE_LIST
+	#undef X
+};
+
+
+
+#define X( id, line, responce, timeout )		static const char sim868_line__##id[] PROGMEM = line;
+SIM868_COMMAND_LIST
+#undef X
+
+const sim868_command_line_t sim868_command_table[ SIM868_CMD_COUNT ] PROGMEM =
+{
+	{ 0, 0, SIM868_RESP_NONE, 0 },
+	#define X( id, line, responce, timeout )		{ sim868_line__##id, sizeof(line) - 1, SIM868_RESP_##responce, timeout },
+	SIM868_COMMAND_LIST
+	#undef X
+};
+
+
+
+const unsigned long sim868_baudrate_table[ SIM868_BAUDRATE_TABLE_SIZE ] PROGMEM = { 115200, 57600, 38400, 19200, 9600 };
+
+const unsigned char sim868_cgnsinf_decimals[ SIM868_FIX_FIELDS ] PROGMEM = { 0,0,3,6,6,2,2,1,0,0,1,1,1,0,0,0,0,0,0,1,1 };
+
+const unsigned char sim868_nmea_rmc_decimals[ SIM868_NMEA_DECIMALS_SIZE ] PROGMEM = { 0,3,0,5,0,5,0,2,1,0 };
+const unsigned char sim868_nmea_gga_decimals[ SIM868_NMEA_DECIMALS_SIZE ] PROGMEM = { 0,3,5,0,5,0,0,0,1,2 };
+
+const unsigned int sim868_sin_table[ 19 ] PROGMEM = { 0,87,174,259,342,423,500,574,643,707,766,819,866,906,940,966,985,996,1000 };
+
+const sim868_power_phase_t sim868_power_phase_table[ SIM868_POWER_PHASES ] PROGMEM =
+{
+	{ SIM868_POWER_SIGNAL_AT | SIM868_POWER_SIGNAL_RDY,	10000 / SIM868_TIMEOUT_TICK },
+	{ SIM868_POWER_SIGNAL_CFUN,							5000 / SIM868_TIMEOUT_TICK },
+	{ SIM868_POWER_SIGNAL_CPIN,							5000 / SIM868_TIMEOUT_TICK },
+	{ SIM868_POWER_SIGNAL_CALL,							15000 / SIM868_TIMEOUT_TICK },
+	{ SIM868_POWER_SIGNAL_SMS,							5000 / SIM868_TIMEOUT_TICK },
+};
+
+const unsigned int sim868_month_days[ 12 ] PROGMEM = { 0,31,59,90,120,151,181,212,243,273,304,334 };
+
+const sim868_token_t sim868_token_table[ SIM868_TOKEN_TABLE_SIZE ] PROGMEM =
+{
+	#define X( text, code )		{ text, sizeof(text) - 1, code },
+	SIM868_TOKEN_LIST
+	#undef X
+};
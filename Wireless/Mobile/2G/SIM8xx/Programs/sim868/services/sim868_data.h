@@ -15,58 +15,247 @@ extern "C" {
 
 
 	
-	#define SIM868_HTTPREAD_HEADER_LEN		26
-
-	const char sim868_data__at_plus[]				PROGMEM = "AT+";
-	const char sim868_data__en[]					PROGMEM = "=1";
-	const char sim868_data__dis[]					PROGMEM = "=0";
-	const char sim868_data__get_status[]			PROGMEM = "?";	
-	const char sim868_data__ok[]					PROGMEM = "OK";
-	const char sim868_data__error[]					PROGMEM = "ERROR";	
-	const char sim868_data__comma[]					PROGMEM = ", ";
-	const char sim868_data__space[]					PROGMEM = " ";
-	const char sim868_data__newstr[]				PROGMEM = "\r\n";
-	const char sim868_data__null[]					PROGMEM = "";
-	const char sim868_data__space_10[]				PROGMEM = "          ";
+	//Texts are defined once in sim868_data.c, the declared size keeps sizeof() working here
+	#define SIM868_DATA_LIST \
+		X( sim868_data__at_plus,				"AT+" ) \
+		X( sim868_data__batch,					";+" ) \
+		X( sim868_data__ok,						"OK" ) \
+		X( sim868_data__error,					"ERROR" ) \
+		X( sim868_data__null,					"" ) \
+		X( sim868_command__at,					"AT" ) \
+		X( sim868_data__gnss_get_info,			"CGNSINF: " ) \
+		X( sim868_CmdHttpParaUrlEnd,			"\"" ) \
+		X( sim868_data__content_form,			"application/x-www-form-urlencoded" ) \
+		X( sim868_data__content_octet,			"application/octet-stream" ) \
+		X( sim868_HttpDataDelay,				",100000" ) \
+		X( sim868_HttpRespDownload,				"DOWNLOAD" ) \
+		X( sim868_RespHttpAct200,				"ACTION: 1,200," ) \
+		X( sim868_RespHttpRead,					"READ: " ) \
+		X( sim868_RespCipShut,					"SHUT OK" ) \
+		X( sim868_RespCipRxGet2,				"CIPRXGET: 2," ) \
+		X( sim868_RespConnectOk,				"CONNECT OK" ) \
+		X( sim868_RespConnect,					"CONNECT\r" ) \
+		X( sim868_RespSendOk,					"SEND OK" ) \
+		X( sim868_RespCloseOk,					"CLOSE OK" ) \
+		X( sim868_data__tcp,					"TCP" ) \
+		X( sim868_data__udp,					"UDP" ) \
+		X( sim868_data__quote_comma,			"\",\"" ) \
+		X( sim868_data__dot,					"." ) \
+		X( sim868_data__prompt,					">" ) \
+		X( sim868_data__escape,					"+++" ) \
+		X( sim868_data__cme_error,				"+CME ERROR" ) \
+		X( sim868_data__cms_error,				"+CMS ERROR" ) \
+		X( sim868_urc__creg,					"+CREG: " ) \
+		X( sim868_urc__csq,						"+CSQ: " ) \
+		X( sim868_urc__cmti,					"+CMTI: " ) \
+		X( sim868_urc__pdp_deact,				"+PDP: DEACT" ) \
+		X( sim868_urc__sapbr_deact,				"+SAPBR 1: DEACT" ) \
+		X( sim868_urc__httpaction,				"+HTTPACTION: " ) \
+		X( sim868_urc__power_down,				"NORMAL POWER DOWN" ) \
+		X( sim868_urc__under_voltage,			"UNDER-VOLTAGE" ) \
+		X( sim868_urc__over_voltage,			"OVER-VOLTAGE" ) \
+		X( sim868_urc__rdy,						"RDY" ) \
+		X( sim868_urc__cfun,					"+CFUN: " ) \
+		X( sim868_urc__cpin,					"+CPIN: " ) \
+		X( sim868_urc__cfun_1,					"+CFUN: 1" ) \
+		X( sim868_urc__cpin_ready,				"+CPIN: READY" ) \
+		X( sim868_urc__call_ready,				"Call Ready" ) \
+		X( sim868_urc__sms_ready,				"SMS Ready" ) \
+		X( sim868_urc__ciprxget,				"+CIPRXGET: 1" ) \
+		X( sim868_urc__closed,					"CLOSED" )
 	
-	const char sim868_command__at[]					PROGMEM = "AT";
-	const char sim868_command__power_down[]			PROGMEM = "CPOWD";
-	const char sim868_command__gnss_power[]			PROGMEM = "CGNSPWR";	
-	const char sim868_command__gnss_info[]			PROGMEM = "CGNSINF";
-	const char sim868_command__gnss_filter[]		PROGMEM = "CGNSSEQ";
-		const char sim868_data__gnss_filter_rmc[]		PROGMEM = "RMC";
-		
-	const char sim868_command__gnss_power_on[]		PROGMEM = "CGNSPWR=1";
-	const char sim868_command__gnss_filter_rmc[]	PROGMEM = "CGNSSEQ=\"RMC\"";
-	const char sim868_command__gnss_get_info[]		PROGMEM = "CGNSINF";
-	const char sim868_data__gnss_get_info[]			PROGMEM = "CGNSINF: ";
-	const char sim868_command__gnss_nmea_log_en[]	PROGMEM = "CGNSTST=1";	
-	const char sim868_CmdCReg[]						PROGMEM = "CREG?";
-	const char sim868_CmdCRegResp[]					PROGMEM = "CREG: ";
-	const char sim868_CmdSapbr31Gprs[]				PROGMEM = "SAPBR=3,1,\"CONTYPE\",\"GPRS\"";
-	const char sim868_CmdSapbrGprs11[]				PROGMEM = "SAPBR=1,1";
-	const char sim868_CmdSapbrGprs01[]				PROGMEM = "SAPBR=0,1";
-	const char sim868_TextHttp[]					PROGMEM = "HTTP";
-	const char sim868_CmdHttpInit[]					PROGMEM = "INIT";
-	const char sim868_CmdHttpTerm[]					PROGMEM = "TERM";
-	const char sim868_TextPara[]					PROGMEM = "PARA=\"";
-	const char sim868_CmdHttpParaCid1[]				PROGMEM = "CID\",1";
-	const char sim868_CmdHttpParaUrl[]				PROGMEM = "URL\",\"";
-	const char sim868_CmdHttpParaUrlEnd[]			PROGMEM = "\"";
-	const char sim868_CmdHttpParaContApl[]			PROGMEM = "CONTENT\",\"application/x-www-form-urlencoded\"";
-	const char sim868_CmdHttpAct[]					PROGMEM = "ACTION=1";
-	const char sim868_RespHttpAct200[]				PROGMEM = "ACTION: 1,200,";
-	const char sim868_CmdHttpRead[]					PROGMEM = "READ";
-	const char sim868_RespHttpRead[]				PROGMEM = "READ: ";
-	const char sim868_CmdHttpData[]					PROGMEM = "DATA=";
-	const char sim868_HttpDataDelay[]				PROGMEM = ",100000";
-	const char sim868_HttpRespDownload[]			PROGMEM = "DOWNLOAD";
-	const char sim868_HttpRespAllOk[]				PROGMEM = "ALL-OK";
-		
+	#define X( name, text )		extern const char name[ sizeof(text) ] PROGMEM;
+	SIM868_DATA_LIST
+	#undef X
+
+
+
+	//Expected responces of the command table, SIM868_RESP_NONE is not checked
+	#define SIM868_RESPONCE_LIST \
+		X( OK,					sim868_data__ok ) \
+		X( GNSS_INFO,			sim868_data__gnss_get_info ) \
+		X( DOWNLOAD,			sim868_HttpRespDownload ) \
+		X( HTTP_ACTION_200,		sim868_RespHttpAct200 ) \
+		X( HTTP_READ,			sim868_RespHttpRead ) \
+		X( SHUT_OK,				sim868_RespCipShut ) \
+		X( DOT,					sim868_data__dot ) \
+		X( CONNECT_OK,			sim868_RespConnectOk ) \
+		X( CONNECT,				sim868_RespConnect ) \
+		X( PROMPT,				sim868_data__prompt ) \
+		X( SEND_OK,				sim868_RespSendOk ) \
+		X( CIPRXGET_2,			sim868_RespCipRxGet2 ) \
+		X( CLOSE_OK,			sim868_RespCloseOk )
+	
+	enum
+	{
+		SIM868_RESP_NONE,
+		#define X( id, text )		SIM868_RESP_##id,
+		SIM868_RESPONCE_LIST
+		#undef X
+		SIM868_RESP_COUNT
+	};
+	
+	typedef struct
+	{
+		const char*   text;
+		unsigned char len;
+	} sim868_responce_pattern_t;
+	
+	extern const sim868_responce_pattern_t sim868_responce_table[ SIM868_RESP_COUNT ] PROGMEM;
+
+
+
+	//Full command lines sent as one block: id, line, expected responce, default timeout in ticks
+	//print() of the command adds the rest of the line after the ones ending with "=" or a quote
+	#define SIM868_COMMAND_LIST \
+		X( CREG_QUERY,			"AT+CREG?",											OK,					600 ) \
+		X( CREG_REPORT,			"AT+CREG=2",										OK,					600 ) \
+		X( CSQ,					"AT+CSQ",											OK,					150 ) \
+		X( GNSS_POWER_ON,		"AT+CGNSPWR=1",										OK,					600 ) \
+		X( GNSS_FILTER_RMC,		"AT+CGNSSEQ=\"RMC\"",								OK,					600 ) \
+		X( GNSS_INFO,			"AT+CGNSINF",										GNSS_INFO,			600 ) \
+		X( GNSS_NMEA_ON,		"AT+CGNSTST=1",										OK,					600 ) \
+		X( GNSS_NMEA_OFF,		"AT+CGNSTST=0",										OK,					600 ) \
+		X( POWER_DOWN,			"AT+CPOWD=1",										NONE,				600 ) \
+		X( CFUN_RESET,			"AT+CFUN=1,1",										OK,					600 ) \
+		X( CSCLK_DTR,			"AT+CSCLK=1",										OK,					150 ) \
+		X( CSCLK_AUTO,			"AT+CSCLK=2",										OK,					150 ) \
+		X( CMUX,				"AT+CMUX=0",										OK,					600 ) \
+		X( IPR,					"AT+IPR=",											OK,					150 ) \
+		X( SAPBR_GPRS,			"AT+SAPBR=3,1,\"CONTYPE\",\"GPRS\"",				OK,					600 ) \
+		X( SAPBR_OPEN,			"AT+SAPBR=1,1",										OK,					600 ) \
+		X( SAPBR_CLOSE,			"AT+SAPBR=0,1",										OK,					600 ) \
+		X( HTTP_INIT,			"AT+HTTPINIT",										OK,					600 ) \
+		X( HTTP_TERM,			"AT+HTTPTERM",										OK,					600 ) \
+		X( HTTP_CID,			"AT+HTTPPARA=\"CID\",1",							OK,					150 ) \
+		X( HTTP_URL,			"AT+HTTPPARA=\"URL\",\"",							OK,					600 ) \
+		X( HTTP_CONTENT,		"AT+HTTPPARA=\"CONTENT\",\"",						OK,					150 ) \
+		X( HTTP_DATA,			"AT+HTTPDATA=",										DOWNLOAD,			600 ) \
+		X( HTTP_ACTION,			"AT+HTTPACTION=1",									HTTP_ACTION_200,	6000 ) \
+		X( HTTP_READ,			"AT+HTTPREAD",										HTTP_READ,			600 ) \
+		X( CIPSHUT,				"AT+CIPSHUT",										SHUT_OK,			600 ) \
+		X( CIPMUX,				"AT+CIPMUX=0",										OK,					600 ) \
+		X( CIPMODE,				"AT+CIPMODE=",										OK,					600 ) \
+		X( CIPRXGET_MANUAL,		"AT+CIPRXGET=1",									OK,					600 ) \
+		X( CSTT,				"AT+CSTT=\"",										OK,					600 ) \
+		X( CIICR,				"AT+CIICR",											OK,					6000 ) \
+		X( CIFSR,				"AT+CIFSR",											DOT,				600 ) \
+		X( CIPSTART,			"AT+CIPSTART=\"",									CONNECT_OK,			6000 ) \
+		X( CIPSEND,				"AT+CIPSEND=",										PROMPT,				600 ) \
+		X( CIPRXGET_READ,		"AT+CIPRXGET=2,",									CIPRXGET_2,			600 ) \
+		X( CIPCLOSE,			"AT+CIPCLOSE",										CLOSE_OK,			600 )
 	
+	enum
+	{
+		SIM868_CMD_NONE,
+		#define X( id, line, responce, timeout )		SIM868_CMD_##id,
+		SIM868_COMMAND_LIST
+		#undef X
+		SIM868_CMD_COUNT
+	};
+	
+	typedef struct
+	{
+		const char*   text;			//whole line from "AT", without line end
+		unsigned char len;
+		unsigned char responce;		//SIM868_RESP_*
+		unsigned int  timeout;
+	} sim868_command_line_t;
+	
+	extern const sim868_command_line_t sim868_command_table[ SIM868_CMD_COUNT ] PROGMEM;
+
+
+
+	//Rates tried by sim868_baudrate_sync(), fastest first
+	#define SIM868_BAUDRATE_TABLE_SIZE		5
+	
+	extern const unsigned long sim868_baudrate_table[ SIM868_BAUDRATE_TABLE_SIZE ] PROGMEM;
+
+
+
+	//Fraction digits kept for every +CGNSINF: field, milliseconds for UTC
+	extern const unsigned char sim868_cgnsinf_decimals[ SIM868_FIX_FIELDS ] PROGMEM;
+
+
+
+	//Fraction digits kept for RMC and GGA fields, ddmm.mmmmm coordinates
+	#define SIM868_NMEA_DECIMALS_SIZE		10
+	
+	extern const unsigned char sim868_nmea_rmc_decimals[ SIM868_NMEA_DECIMALS_SIZE ] PROGMEM;
+	extern const unsigned char sim868_nmea_gga_decimals[ SIM868_NMEA_DECIMALS_SIZE ] PROGMEM;
+
+
+
+	//sin() * 1000 for 0..90 degrees with 5 degrees step
+	extern const unsigned int sim868_sin_table[ 19 ] PROGMEM;
+
+
+
+	//Power up phases from SIM868_POWER_ALIVE: signals that end a phase and its timeout
+	typedef struct
+	{
+		unsigned char signals;
+		unsigned int  timeout;
+	} sim868_power_phase_t;
+	
+	extern const sim868_power_phase_t sim868_power_phase_table[ SIM868_POWER_PHASES ] PROGMEM;
+
+
+
+	//Days before each month of a non leap year
+	extern const unsigned int sim868_month_days[ 12 ] PROGMEM;
+
+
+
+	//Line start tokens, checked together with the expected responce for every received byte
+	#define SIM868_TOKEN_OK					0
+	#define SIM868_TOKEN_ERROR				1
+	#define SIM868_TOKEN_URC				2
+	#define SIM868_TOKEN_ECHO				3
+	#define SIM868_TOKEN_NONE				0xFF
+
+	typedef struct
+	{
+		const char*   text;
+		unsigned char len;
+		unsigned char code;
+	} sim868_token_t;
+
+	#define SIM868_TOKEN_LIST \
+		X( sim868_data__ok,				SIM868_TOKEN_OK ) \
+		X( sim868_data__error,			SIM868_TOKEN_ERROR ) \
+		X( sim868_data__cme_error,		SIM868_TOKEN_ERROR ) \
+		X( sim868_data__cms_error,		SIM868_TOKEN_ERROR ) \
+		X( sim868_command__at,			SIM868_TOKEN_ECHO ) \
+		X( sim868_urc__creg,			SIM868_TOKEN_URC ) \
+		X( sim868_urc__csq,				SIM868_TOKEN_URC ) \
+		X( sim868_urc__cmti,			SIM868_TOKEN_URC ) \
+		X( sim868_urc__pdp_deact,		SIM868_TOKEN_URC ) \
+		X( sim868_urc__sapbr_deact,		SIM868_TOKEN_URC ) \
+		X( sim868_urc__power_down,		SIM868_TOKEN_URC ) \
+		X( sim868_urc__under_voltage,	SIM868_TOKEN_URC ) \
+		X( sim868_urc__over_voltage,	SIM868_TOKEN_URC ) \
+		X( sim868_urc__rdy,				SIM868_TOKEN_URC ) \
+		X( sim868_urc__cfun,			SIM868_TOKEN_URC ) \
+		X( sim868_urc__cpin,			SIM868_TOKEN_URC ) \
+		X( sim868_urc__call_ready,		SIM868_TOKEN_URC ) \
+		X( sim868_urc__sms_ready,		SIM868_TOKEN_URC ) \
+		X( sim868_urc__ciprxget,		SIM868_TOKEN_URC )
+	
+	enum
+	{
+		#define X( text, code )		SIM868_TOKEN_INDEX_##text,
+		SIM868_TOKEN_LIST
+		#undef X
+		SIM868_TOKEN_TABLE_SIZE
+	};
+	
+	extern const sim868_token_t sim868_token_table[ SIM868_TOKEN_TABLE_SIZE ] PROGMEM;
+
+
 		
 #ifdef	__cplusplus
 }
 #endif
 
-#endif //sim868_868_DATA_H_
\ No newline at end of file
+#endif //sim868_868_DATA_H_
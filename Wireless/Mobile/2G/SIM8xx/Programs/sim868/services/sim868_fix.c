@@ -0,0 +1,164 @@
+/*
+ * sim868_fix.c
+ *
+ * +CGNSINF and NMEA field parsing of the sim868 driver, declared in sim868_fix.h
+ * Nothing here touches the usart or the modem state, so it also builds on the host for ../tests
+ */ 
+
+#include "../config/ide_config.h"
+#include <avr/pgmspace.h>
+
+#include "sim868.h"
+#include "sim868_data.h"
+#include "sim868_fix.h"
+#include "../config/sim868_config.h"
+#include "../utilities/functions.h"
+
+
+
+//Single pass over the line after "+CGNSINF: ", GOOD_CODE if it has a valid position
+unsigned char sim868_cgnsinf_parse( const char* text, unsigned char len, sim868_fix_t* fix )
+{
+	sim868_field_t field;
+	unsigned char index = 0;
+	
+	*fix = (sim868_fix_t){ 0 };
+	sim868_field_begin( &field, pgm_read_byte( &sim868_cgnsinf_decimals[0] ) );
+	
+	for( unsigned int i=0; i<=len; i++ )
+	{
+		char ch = ( i < len ) ? text[i] : ',';
+		
+		if( ch != ',' )
+		{
+			if( index == SIM868_FIX_FIELD_UTC ) sim868_fix_utc_put( fix, &field, ch );
+			else sim868_field_put( &field, ch );
+			continue;
+		}
+		
+		sim868_fix_field_store( fix, index, &field );
+		if( ++index >= SIM868_FIX_FIELDS ) break;
+		sim868_field_begin( &field, pgm_read_byte( &sim868_cgnsinf_decimals[ index ] ) );
+	}
+	
+	if( fix->fix && (fix->fields & (1UL << SIM868_FIX_FIELD_LATITUDE)) && (fix->fields & (1UL << SIM868_FIX_FIELD_LONGITUDE)) ) return GOOD_CODE;
+	
+	fix->fix = 0;
+	return ERROR_CODE;
+}
+
+void sim868_field_begin( sim868_field_t* field, unsigned char decimals )
+{
+	field->value = 0;
+	field->decimals = decimals;
+	field->digits = 0;
+	field->flags = 0;
+}
+
+void sim868_field_put( sim868_field_t* field, char ch )
+{
+	if( ch == '-' ) field->flags |= SIM868_FIELD_FLAG_NEGATIVE;
+	if( ch == '.' ) field->flags |= SIM868_FIELD_FLAG_FRACTION;
+	if( (ch < '0') || (ch > '9') ) return;
+	
+	field->digits++;
+	if( field->flags & SIM868_FIELD_FLAG_FRACTION )
+	{
+		if( !field->decimals ) return;
+		field->decimals--;
+	}
+	field->value = field->value * 10 + ( ch - '0' );
+}
+
+//Scales to the field decimals, "1.5" with 3 decimals is 1500
+long sim868_field_end( sim868_field_t* field )
+{
+	for( ; field->decimals; field->decimals-- ) field->value *= 10;
+	
+	return ( field->flags & SIM868_FIELD_FLAG_NEGATIVE ) ? -field->value : field->value;
+}
+
+//yyyyMMddhhmmss.sss, split by digit position
+void sim868_fix_utc_put( sim868_fix_t* fix, sim868_field_t* field, char ch )
+{
+	if( ch == '.' ) field->value = 0;
+	if( (ch == '.') || (field->flags & SIM868_FIELD_FLAG_FRACTION) )
+	{
+		sim868_field_put( field, ch );
+		return;
+	}
+	if( (ch < '0') || (ch > '9') ) return;
+	
+	field->value = field->value * 10 + ( ch - '0' );
+	
+	switch( ++field->digits )
+	{
+		case 4:  fix->year = field->value;		break;
+		case 6:  fix->month = field->value;		break;
+		case 8:  fix->day = field->value;		break;
+		case 10: fix->hour = field->value;		break;
+		case 12: fix->minute = field->value;	break;
+		case 14: fix->second = field->value;	break;
+		default: return;
+	}
+	field->value = 0;
+}
+
+void sim868_fix_field_store( sim868_fix_t* fix, unsigned char index, sim868_field_t* field )
+{
+	long value = sim868_field_end( field );
+	unsigned int value_uint = ( value < 0 ) ? 0 : ( value > 0xFFFF ) ? 0xFFFF : value;
+	unsigned char value_uchar = ( value_uint > 0xFF ) ? 0xFF : value_uint;
+	
+	if( !field->digits ) return;
+	fix->fields |= 1UL << index;
+	
+	switch( index )
+	{
+		case SIM868_FIX_FIELD_RUN:			fix->run = value_uchar;				break;
+		case SIM868_FIX_FIELD_FIX:			fix->fix = value_uchar;				break;
+		case SIM868_FIX_FIELD_UTC:			fix->millisecond = value_uint;		break;
+		case SIM868_FIX_FIELD_LATITUDE:		fix->latitude = value;				break;
+		case SIM868_FIX_FIELD_LONGITUDE:	fix->longitude = value;				break;
+		case SIM868_FIX_FIELD_ALTITUDE:		fix->altitude = value;				break;
+		case SIM868_FIX_FIELD_SPEED:		fix->speed = value_uint;			break;
+		case SIM868_FIX_FIELD_COURSE:		fix->course = value_uint;			break;
+		case SIM868_FIX_FIELD_MODE:			fix->mode = value_uchar;			break;
+		case SIM868_FIX_FIELD_HDOP:			fix->hdop = value_uint;				break;
+		case SIM868_FIX_FIELD_PDOP:			fix->pdop = value_uint;				break;
+		case SIM868_FIX_FIELD_VDOP:			fix->vdop = value_uint;				break;
+		case SIM868_FIX_FIELD_SATS_VIEW:	fix->sats_view = value_uchar;		break;
+		case SIM868_FIX_FIELD_SATS_GNSS:	fix->sats_gnss = value_uchar;		break;
+		case SIM868_FIX_FIELD_SATS_GLONASS:	fix->sats_glonass = value_uchar;	break;
+		case SIM868_FIX_FIELD_CN0:			fix->cn0 = value_uchar;				break;
+		case SIM868_FIX_FIELD_HPA:			fix->hpa = value_uint;				break;
+		case SIM868_FIX_FIELD_VPA:			fix->vpa = value_uint;				break;
+	}
+}
+
+//degrees * 1000000 as "-55.751244", "0" for 0, returns the length
+unsigned char sim868_degrees_text( char* text, long value )
+{
+	unsigned long rest;
+	unsigned char degrees;
+	unsigned char len = 0;
+	
+	if( !value )
+	{
+		text[0] = '0';
+		return 1;
+	}
+	
+	if( value < 0 ) text[ len++ ] = '-';
+	rest = ( value < 0 ) ? -value : value;
+	
+	degrees = rest / 1000000;	//180 at most
+	rest %= 1000000;
+	if( degrees >= 100 ) text[ len++ ] = '0' + degrees / 100;
+	if( degrees >= 10 ) text[ len++ ] = '0' + ( degrees / 10 ) % 10;
+	text[ len++ ] = '0' + degrees % 10;
+	text[ len++ ] = '.';
+	for( unsigned long a = 100000; a; a /= 10 ) text[ len++ ] = '0' + ( rest / a ) % 10;
+	
+	return len;
+}
@@ -0,0 +1,43 @@
+/*
+ * sim868_fix.h
+ *
+ * +CGNSINF parser and field parsing shared with the NMEA ISR, defined in sim868_fix.c
+ */ 
+
+
+#ifndef SIM868_FIX_H_
+#define SIM868_FIX_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+
+	
+	//Fixed-point number accumulated from the digits of one comma separated field
+	typedef struct
+	{
+		long          value;
+		unsigned char decimals;		//fraction digits still taken, the rest are dropped
+		unsigned char digits;		//0 for an empty field
+		unsigned char flags;
+	} sim868_field_t;
+	
+	#define SIM868_FIELD_FLAG_NEGATIVE		0x01
+	#define SIM868_FIELD_FLAG_FRACTION		0x02
+	
+	unsigned char sim868_cgnsinf_parse( const char* text, unsigned char len, sim868_fix_t* fix );
+	void sim868_field_begin( sim868_field_t* field, unsigned char decimals );
+	void sim868_field_put( sim868_field_t* field, char ch );
+	long sim868_field_end( sim868_field_t* field );
+	void sim868_fix_utc_put( sim868_fix_t* fix, sim868_field_t* field, char ch );
+	void sim868_fix_field_store( sim868_fix_t* fix, unsigned char index, sim868_field_t* field );
+	unsigned char sim868_degrees_text( char* text, long value );
+
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif //SIM868_FIX_H_
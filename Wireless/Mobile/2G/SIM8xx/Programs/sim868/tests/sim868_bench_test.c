@@ -0,0 +1,370 @@
+/*
+ * sim868_bench_test.c
+ *
+ * Host run of the whole driver against a modem model that answers every command at once, so
+ * the figures are the driver's own share of the latency: guard pauses, round trips and UART
+ * bytes at the negotiated rate. Network time, bytes on air and supply current are not modelled,
+ * those still have to be measured on a module. Run from this folder:
+ * gcc -std=gnu99 -Wall -I stubs/include sim868_bench_test.c ../services/sim868.c ../services/sim868_data.c ../services/sim868_fix.c -o sim868_bench_test && ./sim868_bench_test
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "../services/sim868.h"
+#include "../config/sim868_config.h"
+#include "../utilities/functions.h"
+
+
+
+volatile unsigned char SREG = 1 << SREG_I;
+volatile unsigned char MCUSR;
+volatile unsigned char sim868_host_udr;
+unsigned long sim868_host_baudrate;
+
+void sim868_host_usart_rx(void);
+
+//Modem model: bytes to the driver wait in a ring and arrive at the usart rate as time passes
+#define SIM868_BENCH_RX_SIZE		4096
+#define SIM868_BENCH_BODY			"{\"ok\":1}"
+
+char sim868_bench_rx[ SIM868_BENCH_RX_SIZE ];
+unsigned int sim868_bench_rx_head;
+unsigned int sim868_bench_rx_tail;
+double sim868_bench_rx_credit;			//bytes the line could have carried so far
+
+char sim868_bench_line[ 512 ];
+unsigned int sim868_bench_line_len;
+unsigned int sim868_bench_raw;			//payload bytes still expected after DOWNLOAD or '>'
+const char* sim868_bench_raw_reply;
+
+unsigned char sim868_bench_powered;
+unsigned char sim868_bench_booted;		//readiness URCs sent since power on
+unsigned char sim868_bench_en = 1;		//PWRKEY idles high
+double sim868_bench_en_low;				//time the EN pin went low
+unsigned char sim868_bench_dtr;
+unsigned char sim868_bench_csclk;
+
+double sim868_bench_ms;					//time of the model
+unsigned int sim868_bench_commands;		//AT lines taken
+unsigned int sim868_bench_lost;			//lines sent to a module that was asleep
+unsigned int sim868_bench_errors;
+
+unsigned char sim868_bench_done;
+unsigned char sim868_bench_code;
+unsigned char sim868_bench_good;			//queued requests ended good
+
+
+
+void sim868_bench_reply( const char* text )
+{
+	for( unsigned int i=0; text[i]; i++ )
+	{
+		sim868_bench_rx[ sim868_bench_rx_head ] = text[i];
+		sim868_bench_rx_head = ( sim868_bench_rx_head + 1 ) % SIM868_BENCH_RX_SIZE;
+	}
+}
+
+void sim868_bench_command( const char* line )
+{
+	char text[ 96 ];
+	unsigned int value;
+
+	if( !sim868_bench_powered ) return;		//probed before the pulse
+	if( sim868_bench_csclk && sim868_bench_dtr )
+	{
+		sim868_bench_lost++;
+		return;
+	}
+
+	sim868_bench_commands++;
+
+	if( !strcmp( line, "AT" ) )
+	{
+		sim868_bench_reply( "AT\r\r\nOK\r\n" );
+		if( !sim868_bench_booted ) sim868_bench_reply( "\r\nRDY\r\n\r\n+CFUN: 1\r\n\r\n+CPIN: READY\r\n\r\nCall Ready\r\n\r\nSMS Ready\r\n" );
+		sim868_bench_booted = 1;
+	}
+	else if( !strncmp( line, "AT+HTTPACTION=", 14 ) )
+	{
+		snprintf( text, sizeof(text), "\r\nOK\r\n\r\n+HTTPACTION: %c,200,%u\r\n", line[14], (unsigned int)strlen( SIM868_BENCH_BODY ) );
+		sim868_bench_reply( text );
+	}
+	else if( !strncmp( line, "AT+HTTPREAD", 11 ) )
+	{
+		snprintf( text, sizeof(text), "\r\n+HTTPREAD: %u\r\n%s\r\nOK\r\n", (unsigned int)strlen( SIM868_BENCH_BODY ), SIM868_BENCH_BODY );
+		sim868_bench_reply( text );
+	}
+	else if( sscanf( line, "AT+HTTPDATA=%u", &value ) == 1 )
+	{
+		sim868_bench_raw = value;
+		sim868_bench_raw_reply = "\r\nOK\r\n";
+		sim868_bench_reply( "\r\nDOWNLOAD\r\n" );
+	}
+	else if( sscanf( line, "AT+CIPSEND=%u", &value ) == 1 )
+	{
+		sim868_bench_raw = value;
+		sim868_bench_raw_reply = "\r\nSEND OK\r\n";
+		sim868_bench_reply( "\r\n> " );
+	}
+	else if( !strncmp( line, "AT+CIPSTART", 11 ) ) sim868_bench_reply( "\r\nOK\r\n\r\nCONNECT OK\r\n" );
+	else if( !strcmp( line, "AT+CIPSHUT" ) ) sim868_bench_reply( "\r\nSHUT OK\r\n" );
+	else if( !strcmp( line, "AT+CIPCLOSE" ) ) sim868_bench_reply( "\r\nCLOSE OK\r\n" );
+	else if( !strcmp( line, "AT+CIFSR" ) ) sim868_bench_reply( "\r\n10.0.0.2\r\n" );
+	else if( !strcmp( line, "AT+CSQ" ) ) sim868_bench_reply( "\r\n+CSQ: 20,0\r\n\r\nOK\r\n" );
+	else if( !strcmp( line, "AT+AT" ) ) sim868_bench_reply( "\r\nERROR\r\n" );		//rate probe of the driver
+	else
+	{
+		if( strstr( line, "+CREG?" ) ) sim868_bench_reply( "\r\n+CREG: 2,1\r\n" );
+		if( strstr( line, "+CSCLK=1" ) ) sim868_bench_csclk = 1;
+		sim868_bench_reply( "\r\nOK\r\n" );
+	}
+}
+
+void sim868_host_tx( char data )
+{
+	if( sim868_bench_raw )
+	{
+		if( !--sim868_bench_raw ) sim868_bench_reply( sim868_bench_raw_reply );
+		return;
+	}
+
+	if( data == '\r' ) return;
+	if( data != '\n' )
+	{
+		if( sim868_bench_line_len < sizeof(sim868_bench_line) - 1 ) sim868_bench_line[ sim868_bench_line_len++ ] = data;
+		return;
+	}
+
+	sim868_bench_line[ sim868_bench_line_len ] = 0;
+	sim868_bench_line_len = 0;
+	sim868_bench_command( sim868_bench_line );
+}
+
+//EN held low for a second toggles the module, it comes up without its URCs until the first AT
+void sim868_host_pin( const char* pin, unsigned char level )
+{
+	if( !strcmp( pin, "SIM868_DTR_PIN" ) ) sim868_bench_dtr = level;
+	if( strcmp( pin, "SIM868_EN_PIN" ) ) return;
+
+	if( !level ) sim868_bench_en_low = sim868_bench_ms;
+	if( level && !sim868_bench_en && (sim868_bench_ms - sim868_bench_en_low >= 1000) )
+	{
+		sim868_bench_powered = !sim868_bench_powered;
+		sim868_bench_booted = 0;
+		sim868_bench_csclk = 0;
+	}
+	sim868_bench_en = level;
+}
+
+//10 bits a byte at the rate the driver set
+void sim868_host_delay_ms( double ms )
+{
+	sim868_bench_ms += ms;
+	sim868_bench_rx_credit += ms * sim868_host_baudrate / 10000.0;
+
+	while( (sim868_bench_rx_credit >= 1) && (sim868_bench_rx_tail != sim868_bench_rx_head) )
+	{
+		sim868_host_udr = sim868_bench_rx[ sim868_bench_rx_tail ];
+		sim868_bench_rx_tail = ( sim868_bench_rx_tail + 1 ) % SIM868_BENCH_RX_SIZE;
+		sim868_bench_rx_credit -= 1;
+		sim868_host_usart_rx();
+	}
+	if( sim868_bench_rx_tail == sim868_bench_rx_head ) sim868_bench_rx_credit = 0;
+}
+
+
+
+void sim868_bench_request_done( unsigned char code, unsigned int responce_len )
+{
+	sim868_bench_code = code;
+	sim868_bench_done = 1;
+}
+
+void sim868_bench_queue_done( unsigned char code, unsigned int responce_len )
+{
+	if( code == GOOD_CODE ) sim868_bench_good++;
+	if( !sim868_request_busy() ) sim868_bench_done = 1;
+}
+
+void sim868_bench_socket_done( unsigned char code, unsigned int len )
+{
+	sim868_bench_code = code;
+	sim868_bench_done = 1;
+}
+
+//Main loop of the firmware until the callback or the time limit
+void sim868_bench_run( unsigned long ms )
+{
+	for( double end = sim868_bench_ms + ms; !sim868_bench_done && (sim868_bench_ms < end); )
+	{
+		sim868_update();
+		_delay_ms( SIM868_TIMEOUT_TICK );
+	}
+}
+
+void sim868_bench_idle( unsigned long ms )
+{
+	sim868_bench_done = 0;
+	sim868_bench_run( ms );
+}
+
+void sim868_bench_check( const char* name, unsigned char good )
+{
+	if( good ) return;
+
+	printf( "  check failed: %s\n", name );
+	sim868_bench_errors++;
+}
+
+//One GET through sim868_request_put(), returns the commands it took
+unsigned int sim868_bench_request( const char* name, const char* host, const char* path )
+{
+	const sim868_request_stat_t* stat = sim868_request_stat_get();
+	unsigned int commands = sim868_bench_commands;
+	unsigned long tx_bytes = stat->tx_bytes;
+
+	sim868_bench_done = 0;
+	sim868_bench_check( name, sim868_request_put( host, path, "?id=1", sim868_bench_request_done ) == GOOD_CODE );
+	sim868_bench_run( 60000 );
+	sim868_bench_check( name, sim868_bench_done && (sim868_bench_code == GOOD_CODE) );
+
+	commands = sim868_bench_commands - commands;
+	printf( "  %-24s %2u commands %5lu ticks %6lu ms %4lu UART bytes\n", name, commands, stat->last, stat->last * SIM868_TIMEOUT_TICK, stat->tx_bytes - tx_bytes );
+
+	return commands;
+}
+
+//Bearer and HTTP service kept open between requests, only changed HTTPPARA values are sent
+void sim868_bench_session(void)
+{
+	unsigned int cold;
+	unsigned int warm;
+	unsigned int path;
+
+	printf( "request latency, one GET at a time at %lu baud\n", sim868_baudrate_get() );
+
+	cold = sim868_bench_request( "first after power up", "http://bench.example", "/a" );
+	warm = sim868_bench_request( "same URL again", "http://bench.example", "/a" );
+	path = sim868_bench_request( "new path, same host", "http://bench.example", "/b" );
+	sim868_bench_idle( SIM868_SESSION_IDLE_TICK * SIM868_TIMEOUT_TICK + 1000 );
+	sim868_bench_request( "after the idle close", "http://bench.example", "/a" );
+
+	sim868_bench_check( "warm request sends fewer commands", warm < cold );
+	sim868_bench_check( "new path sends only the URL more", path == warm + 1 );
+}
+
+//Power up of sim868_init(), the model sends its readiness URCs as soon as the first AT is answered
+void sim868_bench_power(void)
+{
+	const sim868_power_stat_t* stat = sim868_power_stat_get();
+	
+	printf( "power up from off\n" );
+	printf( "  ready after %lu ticks (%lu ms), %u attempts, %u timeouts\n", stat->boot, stat->boot * SIM868_TIMEOUT_TICK, stat->attempts, stat->timeouts );
+	printf( "  phases" );
+	for( unsigned char i=0; i<SIM868_POWER_PHASES; i++ ) printf( " %u", stat->phase[i] );
+	printf( " ticks, first request done after %lu ms\n", stat->first_request * SIM868_TIMEOUT_TICK );
+	
+	sim868_bench_check( "one PWRKEY pulse", stat->attempts == 1 );
+	sim868_bench_check( "no phase timed out", !stat->timeouts );
+}
+
+//Requests queued at once drain through one open bearer, the host change reopens the session
+void sim868_bench_queue(void)
+{
+	static const char* const host[ SIM868_REQUEST_QUEUE_SIZE ] = { "http://bench.example", "http://bench.example", "http://other.example", "http://bench.example" };
+	const sim868_request_stat_t* stat = sim868_request_stat_get();
+	sim868_request_stat_t before = *stat;
+	unsigned int commands = sim868_bench_commands;
+	unsigned int count;
+	
+	sim868_bench_done = 0;
+	sim868_bench_good = 0;
+	for( unsigned char i=0; i<SIM868_REQUEST_QUEUE_SIZE; i++ )
+	{
+		sim868_bench_check( "queue takes the request", sim868_request_put( host[i], "/q", "?id=1", sim868_bench_queue_done ) == GOOD_CODE );
+	}
+	sim868_bench_run( 60000 );
+	
+	count = stat->count - before.count;
+	printf( "queue of %u requests, one to another host\n", SIM868_REQUEST_QUEUE_SIZE );
+	printf( "  %u good, %u commands, %lu ticks sending, %lu ticks waiting, max %lu ticks, depth %u\n", sim868_bench_good, sim868_bench_commands - commands, stat->total - before.total, stat->wait_total - before.wait_total, stat->max, stat->depth_max );
+	if( count ) printf( "  drain %lu ms a request, mean latency %lu ms\n", (stat->total - before.total) * SIM868_TIMEOUT_TICK / count, (stat->total - before.total + stat->wait_total - before.wait_total) * SIM868_TIMEOUT_TICK / count );
+	
+	sim868_bench_check( "all queued requests good", sim868_bench_good == SIM868_REQUEST_QUEUE_SIZE );
+	sim868_bench_check( "queue was full at once", stat->depth_max == SIM868_REQUEST_QUEUE_SIZE );
+}
+
+//Same payload over a TCP socket and as a warm HTTP GET, UART side only
+void sim868_bench_socket(void)
+{
+	static const char payload[] = "id=1";
+	const sim868_socket_stat_t* stat = sim868_socket_stat_get();
+	const sim868_request_stat_t* request = sim868_request_stat_get();
+	unsigned int commands = sim868_bench_commands;
+	unsigned long tx_bytes;
+	unsigned long send_bytes;
+	
+	printf( "socket against HTTP, %u payload bytes\n", (unsigned int)strlen( payload ) );
+	
+	sim868_bench_done = 0;
+	sim868_bench_check( "socket open", sim868_socket_open( SIM868_SOCKET_TCP, "bench.example", 80, 0, sim868_bench_socket_done ) == GOOD_CODE );
+	sim868_bench_run( 60000 );
+	sim868_bench_check( "socket open", sim868_bench_done && (sim868_bench_code == GOOD_CODE) );
+	printf( "  %-24s %2u commands %5lu UART bytes\n", "open", sim868_bench_commands - commands, stat->tx_bytes );
+	
+	commands = sim868_bench_commands;
+	tx_bytes = stat->tx_bytes;
+	sim868_bench_done = 0;
+	sim868_bench_check( "socket send", sim868_socket_send( payload, strlen( payload ), sim868_bench_socket_done ) == GOOD_CODE );
+	sim868_bench_run( 60000 );
+	sim868_bench_check( "socket send", sim868_bench_done && (sim868_bench_code == GOOD_CODE) );
+	send_bytes = stat->tx_bytes - tx_bytes;
+	printf( "  %-24s %2u commands %5lu ticks %6lu ms %4lu UART bytes\n", "send", sim868_bench_commands - commands, stat->send_last, stat->send_last * SIM868_TIMEOUT_TICK, send_bytes );
+	
+	sim868_bench_done = 0;
+	sim868_bench_check( "socket close", sim868_socket_close( sim868_bench_socket_done ) == GOOD_CODE );
+	sim868_bench_run( 60000 );
+	sim868_bench_check( "socket close", sim868_bench_done && (sim868_socket_state_get() == SIM868_SOCKET_CLOSED) );
+	
+	tx_bytes = request->tx_bytes;
+	sim868_bench_request( "HTTP GET, warm", "http://bench.example", "/q" );
+	sim868_bench_check( "socket send takes fewer UART bytes than the GET", send_bytes < request->tx_bytes - tx_bytes );
+	sim868_bench_check( "socket send is faster than the GET", stat->send_last < request->last );
+}
+
+//Module left asleep past SIM868_SLEEP_IDLE_TICK, the next request pays the wake up
+void sim868_bench_sleep(void)
+{
+	const sim868_sleep_stat_t* stat = sim868_sleep_stat_get();
+	unsigned int wakes = stat->wakes;
+	
+	printf( "request after sleep, SIM868_SLEEP_MODE %u\n", SIM868_SLEEP_MODE );
+	sim868_bench_idle( SIM868_SLEEP_IDLE_TICK * SIM868_TIMEOUT_TICK + 1000 );
+	sim868_bench_check( "module asleep after the idle time", !SIM868_SLEEP_MODE || sim868_bench_csclk );
+	
+	sim868_bench_request( "GET after sleep", "http://bench.example", "/a" );
+	printf( "  wake latency last %u ticks (%u ms), max %u ticks, %u sleeps, %u wakes, %lu ticks asleep\n", stat->latency_last, stat->latency_last * SIM868_TIMEOUT_TICK, stat->latency_max, stat->sleeps, stat->wakes, stat->asleep );
+	
+	sim868_bench_check( "request woke the module", !SIM868_SLEEP_MODE || (stat->wakes > wakes) );
+}
+
+int main(void)
+{
+	sim868_init();
+	sim868_bench_check( "power up", sim868_power_state_get() == SIM868_POWER_READY );
+	sim868_bench_idle( 1000 );
+
+	sim868_bench_session();
+	sim868_bench_power();
+	sim868_bench_queue();
+	sim868_bench_socket();
+	sim868_bench_sleep();
+
+	sim868_bench_check( "no command lost while the module was asleep", !sim868_bench_lost );
+	printf( "%s, %u errors\n", sim868_bench_errors ? "FAIL" : "PASS", sim868_bench_errors );
+
+	return sim868_bench_errors ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * sim868_fix_test.c
+ *
+ * Host test of the +CGNSINF parser against lines recorded from a SIM868, run from this folder:
+ * gcc -std=gnu99 -Wall -I stubs/include sim868_fix_test.c ../services/sim868_fix.c ../services/sim868_data.c -o sim868_fix_test && ./sim868_fix_test
+ */ 
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "../services/sim868.h"
+#include "../services/sim868_fix.h"
+#include "../utilities/functions.h"
+
+
+
+typedef struct
+{
+	const char*   line;			//after "+CGNSINF: "
+	unsigned char code;
+	long          latitude;
+	long          longitude;
+	long          altitude;
+	unsigned int  speed;
+	unsigned int  course;
+	unsigned int  hdop;
+	unsigned char sats_gnss;
+	unsigned long fields;
+	const char*   utc;			//"yyyy-MM-dd hh:mm:ss.sss"
+} sim868_fix_case_t;
+
+const sim868_fix_case_t sim868_fix_cases[] =
+{
+	{ "1,1,20190120211220.000,55.751244,37.618423,150.500,1.85,273.4,1,,1.2,1.5,0.9,,12,8,3,,40,,",
+		GOOD_CODE, 55751244, 37618423, 15050, 185, 2734, 12, 8, 0x05DDFF, "2019-01-20 21:12:20.000" },
+	{ "1,0,20190120211220.000,,,,0.00,0.0,0,,,,,,9,0,,,,,",
+		ERROR_CODE, 0, 0, 0, 0, 0, 0, 0, 0x00C1C7, "2019-01-20 21:12:20.000" },
+	{ "1,1,20231231235959.123,-33.868820,-151.209296,-5.2,12.3456,9,1,,0.8,1.1,0.7,,20,14,6,,45,3.1,4.2",
+		GOOD_CODE, -33868820, -151209296, -520, 1234, 90, 8, 14, 0x1DDDFF, "2023-12-31 23:59:59.123" },
+	{ "0,,,,,,,,,,,,,,,,,,,,",
+		ERROR_CODE, 0, 0, 0, 0, 0, 0, 0, 0x000001, "0000-00-00 00:00:00.000" },
+	{ "",
+		ERROR_CODE, 0, 0, 0, 0, 0, 0, 0, 0x000000, "0000-00-00 00:00:00.000" },
+};
+
+const struct
+{
+	long        value;
+	const char* text;
+} sim868_degrees_cases[] =
+{
+	{ 0,			"0" },
+	{ 55751244,		"55.751244" },
+	{ -33868820,	"-33.868820" },
+	{ -151209296,	"-151.209296" },
+	{ 5000,			"0.005000" },
+};
+
+unsigned int sim868_fix_test_errors;
+
+
+
+void sim868_fix_test_check( unsigned char index, const char* name, long expected, long got )
+{
+	if( expected == got ) return;
+	
+	printf( "case %u: %s expected %ld, got %ld\n", index, name, expected, got );
+	sim868_fix_test_errors++;
+}
+
+int main(void)
+{
+	sim868_fix_t fix;
+	char text[ 256 ];
+	
+	for( unsigned char i=0; i<sizeof(sim868_fix_cases)/sizeof(sim868_fix_cases[0]); i++ )
+	{
+		const sim868_fix_case_t* c = &sim868_fix_cases[i];
+		unsigned char code = sim868_cgnsinf_parse( c->line, strlen( c->line ), &fix );
+		
+		sim868_fix_test_check( i, "code", c->code, code );
+		sim868_fix_test_check( i, "latitude", c->latitude, fix.latitude );
+		sim868_fix_test_check( i, "longitude", c->longitude, fix.longitude );
+		sim868_fix_test_check( i, "altitude", c->altitude, fix.altitude );
+		sim868_fix_test_check( i, "speed", c->speed, fix.speed );
+		sim868_fix_test_check( i, "course", c->course, fix.course );
+		sim868_fix_test_check( i, "hdop", c->hdop, fix.hdop );
+		sim868_fix_test_check( i, "sats_gnss", c->sats_gnss, fix.sats_gnss );
+		sim868_fix_test_check( i, "fields", c->fields, fix.fields );
+		
+		snprintf( text, sizeof(text), "%04u-%02u-%02u %02u:%02u:%02u.%03u", fix.year, fix.month, fix.day, fix.hour, fix.minute, fix.second, fix.millisecond );
+		if( strcmp( text, c->utc ) )
+		{
+			printf( "case %u: utc expected %s, got %s\n", i, c->utc, text );
+			sim868_fix_test_errors++;
+		}
+	}
+	
+	//one field of 255 characters, the longest length the parser takes, is read once
+	memset( text, ' ', 255 );
+	text[0] = '1';
+	sim868_cgnsinf_parse( text, 255, &fix );
+	sim868_fix_test_check( 255, "run", 1, fix.run );
+	sim868_fix_test_check( 255, "fields", 0x000001, fix.fields );
+	
+	for( unsigned char i=0; i<sizeof(sim868_degrees_cases)/sizeof(sim868_degrees_cases[0]); i++ )
+	{
+		unsigned char len = sim868_degrees_text( text, sim868_degrees_cases[i].value );
+		
+		text[ len ] = 0;
+		if( strcmp( text, sim868_degrees_cases[i].text ) )
+		{
+			printf( "degrees %ld: expected %s, got %s\n", sim868_degrees_cases[i].value, sim868_degrees_cases[i].text, text );
+			sim868_fix_test_errors++;
+		}
+	}
+	
+	printf( "%s, %u errors\n", sim868_fix_test_errors ? "FAIL" : "PASS", sim868_fix_test_errors );
+	
+	return sim868_fix_test_errors ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+/*
+ * ide_config.h
+ *
+ * Host stand-in, found as "../config/ide_config.h" through -I stubs/include
+ */ 
+
+
+#ifndef IDE_CONFIG_H_
+#define IDE_CONFIG_H_
+
+#define F_CPU		16000000UL
+
+#endif //IDE_CONFIG_H_
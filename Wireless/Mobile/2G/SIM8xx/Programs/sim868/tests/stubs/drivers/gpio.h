@@ -0,0 +1,18 @@
+/*
+ * gpio.h
+ *
+ * Host stand-in, pin changes go to the modem model of the test by pin name
+ */ 
+
+
+#ifndef GPIO_H_
+#define GPIO_H_
+
+void sim868_host_pin( const char* pin, unsigned char level );
+
+#define pin_output( pin )
+#define pin_input( pin )
+#define pin_high( pin )		sim868_host_pin( #pin, 1 )
+#define pin_low( pin )		sim868_host_pin( #pin, 0 )
+
+#endif //GPIO_H_
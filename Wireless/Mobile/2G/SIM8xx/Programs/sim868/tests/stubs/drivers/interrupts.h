@@ -0,0 +1,17 @@
+/*
+ * interrupts.h
+ *
+ * Host stand-in, the global interrupt flag is SREG_I of the test's SREG
+ */ 
+
+
+#ifndef INTERRUPTS_H_
+#define INTERRUPTS_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define interrupts_global_dis()		( SREG &= ~(1 << SREG_I) )
+#define interrupts_global_en()		( SREG |= (1 << SREG_I) )
+
+#endif //INTERRUPTS_H_
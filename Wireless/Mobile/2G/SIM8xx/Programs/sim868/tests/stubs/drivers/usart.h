@@ -0,0 +1,34 @@
+/*
+ * usart.h
+ *
+ * Host stand-in, found as "../drivers/usart.h" through -I stubs/include. Bytes go to and
+ * come from the modem model of the test. Without the empty interrupt the driver sends
+ * byte by byte
+ */ 
+
+
+#ifndef USART_H_
+#define USART_H_
+
+extern volatile unsigned char sim868_host_udr;
+extern unsigned long sim868_host_baudrate;
+void sim868_host_tx( char data );
+
+#define usart_interrupt_vector				sim868_host_usart_rx
+
+#define usart_received_byte_get( data )		( (data) = sim868_host_udr )
+#define usart_transmite_byte_put( data )	sim868_host_tx( data )
+#define usart_transmitted_get()				1
+#define usart_busy_get()					0
+#define usart_baudrate_put( baudrate )		( sim868_host_baudrate = (baudrate) )
+#define usart_reset_full()
+#define usart_regs_clr()
+#define usart_transmitter_ports_init()
+#define usart_transmitter_en()
+#define usart_transmitted_intr_en()
+#define usart_receiver_ports_init()
+#define usart_receiver_en()
+#define usart_received_intr_en()
+#define usart_en()
+
+#endif //USART_H_
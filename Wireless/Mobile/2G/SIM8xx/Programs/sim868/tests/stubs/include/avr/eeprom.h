@@ -0,0 +1,24 @@
+/*
+ * eeprom.h
+ *
+ * Host stand-in for avr-libc, EEPROM is plain memory here
+ */ 
+
+
+#ifndef EEPROM_H_
+#define EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte( const uint8_t* address ) { return *address; }
+static inline void eeprom_update_byte( uint8_t* address, uint8_t value ) { *address = value; }
+static inline void eeprom_write_byte( uint8_t* address, uint8_t value ) { *address = value; }
+static inline uint16_t eeprom_read_word( const uint16_t* address ) { return *address; }
+static inline void eeprom_update_word( uint16_t* address, uint16_t value ) { *address = value; }
+static inline void eeprom_read_block( void* to, const void* from, size_t len ) { memcpy( to, from, len ); }
+static inline void eeprom_update_block( const void* from, void* to, size_t len ) { memcpy( to, from, len ); }
+
+#endif //EEPROM_H_
@@ -0,0 +1,13 @@
+/*
+ * interrupt.h
+ *
+ * Host stand-in for avr-libc, an ISR is a plain function the test calls
+ */ 
+
+
+#ifndef INTERRUPT_H_
+#define INTERRUPT_H_
+
+#define ISR( vector )		void vector(void)
+
+#endif //INTERRUPT_H_
@@ -0,0 +1,16 @@
+/*
+ * io.h
+ *
+ * Host stand-in for avr-libc, only the registers the driver reads, defined by the test
+ */ 
+
+
+#ifndef IO_H_
+#define IO_H_
+
+#define SREG_I			7
+
+extern volatile unsigned char SREG;
+extern volatile unsigned char MCUSR;
+
+#endif //IO_H_
@@ -0,0 +1,21 @@
+/*
+ * pgmspace.h
+ *
+ * Host stand-in for avr-libc, flash is plain memory here
+ */ 
+
+
+#ifndef PGMSPACE_H_
+#define PGMSPACE_H_
+
+#include <string.h>
+
+#define PROGMEM
+#define PSTR( text )				( text )
+#define pgm_read_byte( address )	( *(const unsigned char*)(address) )
+#define pgm_read_word( address )	( *(address) )
+#define pgm_read_dword( address )	( *(address) )
+#define memcpy_P( to, from, len )	memcpy( to, from, len )
+#define strlen_P( text )			strlen( text )
+
+#endif //PGMSPACE_H_
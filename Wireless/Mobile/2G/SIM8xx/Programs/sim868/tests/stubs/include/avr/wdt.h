@@ -0,0 +1,17 @@
+/*
+ * wdt.h
+ *
+ * Host stand-in for avr-libc, the watchdog never fires here
+ */ 
+
+
+#ifndef WDT_H_
+#define WDT_H_
+
+#define WDTO_15MS		0
+
+static inline void wdt_enable( unsigned char timeout ) { (void)timeout; }
+static inline void wdt_disable(void) { }
+static inline void wdt_reset(void) { }
+
+#endif //WDT_H_
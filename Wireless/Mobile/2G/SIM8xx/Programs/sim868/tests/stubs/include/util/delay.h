@@ -0,0 +1,16 @@
+/*
+ * delay.h
+ *
+ * Host stand-in for avr-libc, time passes in the modem model of the test
+ */ 
+
+
+#ifndef DELAY_H_
+#define DELAY_H_
+
+void sim868_host_delay_ms( double ms );
+
+#define _delay_ms( ms )		sim868_host_delay_ms( ms )
+#define _delay_us( us )		sim868_host_delay_ms( (us) / 1000.0 )
+
+#endif //DELAY_H_
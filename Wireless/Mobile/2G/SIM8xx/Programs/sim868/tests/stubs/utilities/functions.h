@@ -0,0 +1,15 @@
+/*
+ * functions.h
+ *
+ * Host stand-in, only what the driver uses
+ */ 
+
+
+#ifndef FUNCTIONS_H_
+#define FUNCTIONS_H_
+
+#define GOOD_CODE		0
+#define ERROR_CODE		1
+#define UINT_LEN		5
+
+#endif //FUNCTIONS_H_